@@ -0,0 +1,263 @@
+﻿#include "batch_runner.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "lockstep.hpp"
+#include "register_access.hpp"
+
+namespace
+{
+    constexpr uint16_t default_code_segment = 0;
+
+    struct job_queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+
+    int find_register(std::string_view name)
+    {
+        for (int i = 0; i < register_count; ++i)
+        {
+            const register_access reg{ .index = static_cast<register_index>(i), .offset = 0, .count = 2 };
+            if (name == get_register_name(reg))
+                return i;
+        }
+
+        throw std::runtime_error{ "Unknown register in batch file." };
+    }
+
+    uint16_t parse_register_value(std::string_view text)
+    {
+        int base = 10;
+        if (text.starts_with("0x"))
+        {
+            text.remove_prefix(2);
+            base = 16;
+        }
+
+        uint16_t value{};
+        const char* text_end = text.data() + text.size();
+        const auto [parse_end, error] = std::from_chars(text.data(), text_end, value, base);
+
+        if (text.empty() || error != std::errc{} || parse_end != text_end)
+            throw std::runtime_error{ "Invalid register value in batch file." };
+
+        return value;
+    }
+
+    // workers take their newest job from their own queue and steal the oldest from the others once it runs dry
+    bool take_job(std::span<job_queue> queues, size_t own_queue, size_t& job)
+    {
+        for (size_t offset = 0; offset < queues.size(); ++offset)
+        {
+            job_queue& queue = queues[(own_queue + offset) % queues.size()];
+            std::scoped_lock lock{ queue.mutex };
+
+            if (queue.jobs.empty())
+                continue;
+
+            if (offset == 0)
+            {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            else
+            {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void load_job(machine& sim, const batch_job& job)
+    {
+        reset_machine(sim);
+        load_program(sim, job.path, default_code_segment);
+
+        for (const auto& [index, value] : job.initial_registers)
+            sim.registers[index] = value;
+    }
+
+    batch_result get_result(machine& sim, stop_reason stop, std::string error)
+    {
+        materialize_flags(sim.lazy, sim.registers);
+
+        return batch_result
+        {
+            .registers = sim.registers,
+            .instruction_count = sim.instruction_count,
+            .total_cycles = sim.total_cycles,
+            .stop = stop,
+            .error = std::move(error)
+        };
+    }
+
+    batch_result run_job(machine& sim, const batch_job& job, const run_limits& limits)
+    {
+        stop_reason stop{};
+        std::string error;
+
+        try
+        {
+            load_job(sim, job);
+            stop = run_machine(sim, limits);
+        }
+        catch (std::exception& ex)
+        {
+            error = ex.what();
+        }
+
+        return get_result(sim, stop, std::move(error));
+    }
+
+    void run_lockstep_group(std::span<machine> sims, std::span<const size_t> group, std::span<const batch_job> jobs, const run_limits& limits,
+        std::span<batch_result> results)
+    {
+        std::array<size_t, lockstep_lane_count> lane_jobs{};
+        size_t lane_count = 0;
+
+        for (const size_t job : group)
+        {
+            try
+            {
+                load_job(sims[lane_count], jobs[job]);
+                lane_jobs[lane_count++] = job;
+            }
+            catch (std::exception& ex)
+            {
+                results[job] = get_result(sims[lane_count], {}, ex.what());
+            }
+        }
+
+        const std::vector<lockstep_outcome> outcomes = run_lockstep(sims.first(lane_count), limits);
+
+        for (size_t lane = 0; lane < lane_count; ++lane)
+            results[lane_jobs[lane]] = get_result(sims[lane], outcomes[lane].stop, outcomes[lane].error);
+    }
+
+    // each job on its own, or with lockstep, jobs running the same program in groups of up to lockstep_lane_count
+    std::vector<std::vector<size_t>> group_jobs(std::span<const batch_job> jobs, bool lockstep)
+    {
+        std::vector<std::vector<size_t>> groups;
+        std::unordered_map<std::string_view, size_t> open_groups;
+
+        for (size_t job = 0; job < jobs.size(); ++job)
+        {
+            if (lockstep)
+            {
+                const auto open_group = open_groups.find(jobs[job].path);
+                if (open_group != open_groups.end() && groups[open_group->second].size() < lockstep_lane_count)
+                {
+                    groups[open_group->second].push_back(job);
+                    continue;
+                }
+
+                open_groups[jobs[job].path] = groups.size();
+            }
+
+            groups.push_back({ job });
+        }
+
+        return groups;
+    }
+}
+
+std::vector<batch_job> read_batch_file(const std::string& path)
+{
+    std::ifstream batch_file{ path };
+
+    if (!batch_file)
+        throw std::runtime_error{ "Cannot open batch file." };
+
+    std::vector<batch_job> jobs;
+    std::string line;
+
+    while (std::getline(batch_file, line))
+    {
+        std::istringstream fields{ line };
+        batch_job job{};
+
+        // skip blank lines and comments
+        if (!(fields >> job.path) || job.path.starts_with('#'))
+            continue;
+
+        std::string assignment;
+        while (fields >> assignment)
+        {
+            const size_t separator = assignment.find('=');
+            if (separator == std::string::npos)
+                throw std::runtime_error{ "Expected a register assignment in batch file." };
+
+            const std::string_view text = assignment;
+            job.initial_registers.emplace_back(find_register(text.substr(0, separator)), parse_register_value(text.substr(separator + 1)));
+        }
+
+        jobs.push_back(std::move(job));
+    }
+
+    return jobs;
+}
+
+std::vector<batch_result> run_batch(std::span<const batch_job> jobs, const run_limits& limits, unsigned thread_count, bool lockstep)
+{
+    const std::vector<std::vector<size_t>> groups = group_jobs(jobs, lockstep);
+
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    thread_count = std::min(thread_count, static_cast<unsigned>(std::max<size_t>(groups.size(), 1)));
+
+    // deal the groups out in contiguous runs, one queue per worker
+    std::vector<job_queue> queues(thread_count);
+    for (size_t i = 0; i < groups.size(); ++i)
+        queues[i * thread_count / groups.size()].jobs.push_back(i);
+
+    std::vector<batch_result> results(jobs.size());
+
+    {
+        std::vector<std::jthread> workers;
+        workers.reserve(thread_count);
+
+        for (unsigned worker = 0; worker < thread_count; ++worker)
+        {
+            workers.emplace_back([&, worker]
+            {
+                // each worker reuses its machines for all of its jobs
+                std::vector<machine> sims;
+                sims.push_back(create_machine());
+
+                size_t group = 0;
+                while (take_job(queues, worker, group))
+                {
+                    if (!lockstep)
+                    {
+                        results[groups[group][0]] = run_job(sims[0], jobs[groups[group][0]], limits);
+                        continue;
+                    }
+
+                    while (sims.size() < groups[group].size())
+                        sims.push_back(create_machine());
+
+                    run_lockstep_group(sims, groups[group], jobs, limits, results);
+                }
+            });
+        }
+    }
+
+    return results;
+}
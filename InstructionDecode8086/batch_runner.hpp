@@ -0,0 +1,35 @@
+﻿#ifndef WS_BATCHRUNNER_HPP
+#define WS_BATCHRUNNER_HPP
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "machine.hpp"
+
+// one program to run, with the register values it starts from
+struct batch_job
+{
+    std::string path;
+    std::vector<std::pair<int, uint16_t>> initial_registers;
+};
+
+struct batch_result
+{
+    register_array registers{};
+    uint64_t instruction_count{};
+    int64_t total_cycles{};
+    stop_reason stop{};
+    std::string error;
+};
+
+// reads one job per line: a program path followed by optional register assignments such as "ax=5 bx=0x10"
+std::vector<batch_job> read_batch_file(const std::string& path);
+
+// runs every job on a pool of threads, each with its own machines; with lockstep, jobs running the same program share
+// their steps through run_lockstep; results are in the same order as the jobs
+std::vector<batch_result> run_batch(std::span<const batch_job> jobs, const run_limits& limits, unsigned thread_count, bool lockstep);
+
+#endif
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cycle_estimator.hpp"
+#include "decode_cache.hpp"
+#include "decoder.hpp"
+#include "formatter.hpp"
+#include "instruction.hpp"
+#include "simulator.hpp"
+#include "threaded_interpreter.hpp"
+
+namespace
+{
+    using benchmark_clock = std::chrono::steady_clock;
+    constexpr auto min_duration = std::chrono::milliseconds{ 500 };
+
+    // the largest stream that still fits in one code segment
+    constexpr size_t synthetic_stream_size = 60'000;
+
+    struct instruction_class
+    {
+        const char* name;
+        std::vector<uint8_t> code;
+    };
+
+    // one encoding for each kind of instruction the simulator handles
+    const std::array instruction_classes =
+    {
+        instruction_class{ "mov reg, imm", { 0xB9, 0x10, 0x27 } },              // mov cx, 10000
+        instruction_class{ "mov reg, reg", { 0x89, 0xCB } },                    // mov bx, cx
+        instruction_class{ "mov reg, mem", { 0x8B, 0x10 } },                    // mov dx, [bx + si]
+        instruction_class{ "mov mem, imm", { 0xC7, 0x42, 0x02, 0x07, 0x00 } },  // mov word [bp + si + 2], 7
+        instruction_class{ "add reg, reg", { 0x01, 0xCB } },                    // add bx, cx
+        instruction_class{ "add mem, imm", { 0x83, 0x07, 0x03 } },              // add word [bx], 3
+        instruction_class{ "sub reg, imm", { 0x83, 0xEB, 0x01 } },              // sub bx, 1
+        instruction_class{ "cmp acc, imm", { 0x3D, 0x05, 0x00 } },              // cmp ax, 5
+        instruction_class{ "jne", { 0x75, 0xF7 } },                             // jne $-9
+        instruction_class{ "loop", { 0xE2, 0xFB } },                            // loop $-5
+        instruction_class{ "jmp", { 0xEB, 0x00 } },                             // jmp $+2
+        instruction_class{ "nop", { 0x90 } }
+    };
+
+    struct benchmark_result
+    {
+        uint64_t operations{};
+        double seconds{};
+    };
+
+    // keeps the compiler from discarding work whose results are otherwise unused
+    uint64_t checksum = 0;
+
+    // calls body until min_duration has passed; body returns how many operations it did
+    template <typename Body>
+    benchmark_result run_benchmark(Body body)
+    {
+        benchmark_result result{};
+
+        const auto start = benchmark_clock::now();
+        auto elapsed = benchmark_clock::duration{};
+
+        do
+        {
+            result.operations += body();
+            elapsed = benchmark_clock::now() - start;
+        }
+        while (elapsed < min_duration);
+
+        result.seconds = std::chrono::duration<double>(elapsed).count();
+        return result;
+    }
+
+    void print_result(std::string_view name, const benchmark_result& result)
+    {
+        const auto operations = static_cast<double>(result.operations);
+        const double nanoseconds_per_operation = result.seconds * 1e9 / operations;
+        const double operations_per_second = operations / result.seconds;
+
+        std::cout << std::format("  {:<28} {:>10.2f} ns/op {:>16.0f} ops/s\n", name, nanoseconds_per_operation, operations_per_second);
+    }
+
+    instruction decode_one(std::span<uint8_t> code)
+    {
+        auto data_iter = code.begin();
+        return decode_instruction(data_iter, code.end(), 0);
+    }
+
+    std::vector<uint8_t> make_synthetic_stream()
+    {
+        std::vector<uint8_t> stream;
+
+        while (stream.size() < synthetic_stream_size)
+        {
+            for (const instruction_class& instruction_kind : instruction_classes)
+                stream.insert(stream.end(), instruction_kind.code.begin(), instruction_kind.code.end());
+        }
+
+        return stream;
+    }
+
+    std::vector<uint8_t> read_program(const std::string& path)
+    {
+        std::ifstream input_file{ path, std::ios::binary };
+
+        if (!input_file)
+            throw std::runtime_error{ "Cannot open binary file." };
+
+        std::vector<uint8_t> program(static_cast<size_t>(std::filesystem::file_size(path)));
+        input_file.read(reinterpret_cast<char*>(program.data()), static_cast<std::streamsize>(program.size()));
+
+        return program;
+    }
+
+    // decodes the whole stream in a linear sweep, counting instructions
+    benchmark_result benchmark_decoding(std::span<uint8_t> stream)
+    {
+        return run_benchmark([stream]
+        {
+            auto data_iter = stream.begin();
+            uint64_t instruction_count = 0;
+
+            while (data_iter < stream.end())
+            {
+                const instruction inst = decode_instruction(data_iter, stream.end(), 0);
+                checksum += inst.size;
+                ++instruction_count;
+            }
+
+            return instruction_count;
+        });
+    }
+
+    // executes one decoded instruction over and over, from the same ip so jumps go nowhere
+    benchmark_result benchmark_simulation(const instruction& inst, memory_array& memory)
+    {
+        constexpr uint64_t steps_per_call = 10'000;
+
+        register_array registers{};
+        registers[1] = 0x1000; // bx
+        registers[5] = 0x2000; // bp
+        registers[6] = 0x0010; // si
+
+        lazy_flags lazy{};
+
+        return run_benchmark([&]
+        {
+            for (uint64_t i = 0; i < steps_per_call; ++i)
+            {
+                registers[instruction_pointer_index] = 0;
+                const simulation_step step = simulate_instruction(inst, registers, memory, lazy);
+                checksum += step.new_ip;
+            }
+
+            return steps_per_call;
+        });
+    }
+
+    // the same, through the handler the instruction is bound to
+    benchmark_result benchmark_threaded(const instruction& inst, memory_array& memory)
+    {
+        constexpr uint64_t steps_per_call = 10'000;
+
+        register_array registers{};
+        registers[1] = 0x1000; // bx
+        registers[5] = 0x2000; // bp
+        registers[6] = 0x0010; // si
+
+        lazy_flags lazy{};
+
+        // instructions without a handler of their own are read from here
+        decode_cache cache = create_decode_cache(0, 0);
+        cache.instructions.push_back(inst);
+
+        const threaded_op op = bind_instruction(inst, 0);
+        threaded_context context{ registers, memory, lazy, cache };
+
+        return run_benchmark([&]
+        {
+            for (uint64_t i = 0; i < steps_per_call; ++i)
+            {
+                registers[instruction_pointer_index] = 0;
+                const simulation_step step = execute_threaded(op, context);
+                checksum += step.new_ip;
+            }
+
+            return steps_per_call;
+        });
+    }
+
+    benchmark_result benchmark_estimation(std::span<const instruction> instructions)
+    {
+        return run_benchmark([instructions]
+        {
+            for (const instruction& inst : instructions)
+            {
+                cycle_estimate estimate{};
+                checksum += try_estimate_cycles(inst, estimate) ? static_cast<uint64_t>(estimate.base.max + estimate.ea) : 0;
+            }
+
+            return instructions.size();
+        });
+    }
+
+    benchmark_result benchmark_formatting(std::span<const instruction> instructions)
+    {
+        std::array<char, line_buffer_size> line_buffer{};
+
+        return run_benchmark([instructions, &line_buffer]
+        {
+            for (const instruction& inst : instructions)
+            {
+                const char* line_end = format_instruction(line_buffer.data(), inst);
+                checksum += static_cast<uint64_t>(line_end - line_buffer.data());
+            }
+
+            return instructions.size();
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+    {
+        std::cout << "Usage: sim86_bench [input_file]\n";
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        std::vector<uint8_t> synthetic_stream = make_synthetic_stream();
+
+        std::cout << "decode_instruction:\n";
+        print_result("synthetic stream", benchmark_decoding(synthetic_stream));
+
+        // a real program when one is given, to compare against the even mix of the synthetic stream
+        if (argc == 2)
+        {
+            std::vector<uint8_t> program = read_program(argv[1]);
+            print_result(std::filesystem::path(argv[1]).filename().string(), benchmark_decoding(program));
+        }
+
+        std::vector<instruction> instructions;
+        for (const instruction_class& instruction_kind : instruction_classes)
+        {
+            std::vector<uint8_t> code = instruction_kind.code;
+            instructions.push_back(decode_one(code));
+        }
+
+        std::cout << "\nsimulate_instruction:\n";
+        const auto memory = std::make_unique<memory_array>();
+
+        for (size_t i = 0; i < instructions.size(); ++i)
+            print_result(instruction_classes[i].name, benchmark_simulation(instructions[i], *memory));
+
+        std::cout << "\nexecute_threaded:\n";
+
+        for (size_t i = 0; i < instructions.size(); ++i)
+            print_result(instruction_classes[i].name, benchmark_threaded(instructions[i], *memory));
+
+        std::cout << "\nestimate_cycles:\n";
+        print_result("every class in turn", benchmark_estimation(instructions));
+
+        std::cout << "\nformat_instruction:\n";
+        print_result("every class in turn", benchmark_formatting(instructions));
+
+        std::cout << std::format("\nChecksum: {:#x}\n", checksum);
+    }
+    catch (std::exception& ex)
+    {
+        std::cout << "ERROR!! " << ex.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+﻿#include "compact_instruction.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <variant>
+
+#include "instruction.hpp"
+#include "overloaded.hpp"
+
+namespace
+{
+    bool fits_in_word(int32_t value)
+    {
+        return value >= INT16_MIN && value <= UINT16_MAX;
+    }
+
+    compact_operand pack_operand(const instruction_operand& operand)
+    {
+        auto matcher = overloaded
+        {
+            [](const effective_address_expression& eae)
+            {
+                if (eae.term1.scale != 0 || eae.explicit_segment != 0 || eae.flags != effective_address_flags::none || !fits_in_word(eae.displacement))
+                    throw std::runtime_error{ "Effective address expression cannot be represented in compact form." };
+
+                return compact_operand
+                {
+                    .value = static_cast<uint16_t>(eae.displacement),
+                    .kind = compact_operand_kind::effective_address,
+                    .reg = pack_register(eae.term1.reg),
+                    .extra = eae.term2.has_value() ? pack_register(eae.term2->reg) : no_compact_register
+                };
+            },
+            [](direct_address address)
+            {
+                if (address.address > UINT16_MAX)
+                    throw std::runtime_error{ "Direct address cannot be represented in compact form." };
+
+                return compact_operand
+                {
+                    .value = static_cast<uint16_t>(address.address),
+                    .kind = compact_operand_kind::direct_address
+                };
+            },
+            [](register_access reg)
+            {
+                return compact_operand
+                {
+                    .kind = compact_operand_kind::register_access,
+                    .reg = pack_register(reg)
+                };
+            },
+            [](immediate imm)
+            {
+                if (!fits_in_word(imm.value))
+                    throw std::runtime_error{ "Immediate cannot be represented in compact form." };
+
+                return compact_operand
+                {
+                    .value = static_cast<uint16_t>(imm.value),
+                    .kind = compact_operand_kind::immediate,
+                    .extra = static_cast<uint8_t>(imm.flags)
+                };
+            },
+            [](std::monostate) { return compact_operand{}; }
+        };
+
+        return std::visit(matcher, operand);
+    }
+
+    instruction_operand unpack_operand(const compact_operand& operand)
+    {
+        switch (operand.kind)
+        {
+            case compact_operand_kind::none:
+                return std::monostate{};
+
+            case compact_operand_kind::effective_address:
+            {
+                effective_address_expression eae
+                {
+                    .term1 = { .reg = unpack_register(operand.reg) },
+                    .displacement = static_cast<int16_t>(operand.value)
+                };
+
+                if (operand.extra != no_compact_register)
+                    eae.term2 = effective_address_term{ .reg = unpack_register(operand.extra) };
+
+                return eae;
+            }
+
+            case compact_operand_kind::direct_address:
+                return direct_address{ .address = operand.value };
+
+            case compact_operand_kind::register_access:
+                return unpack_register(operand.reg);
+
+            case compact_operand_kind::immediate:
+                return immediate
+                {
+                    .value = static_cast<int16_t>(operand.value),
+                    .flags = immediate_flags{ operand.extra }
+                };
+
+            default:
+                throw std::runtime_error{ "Unexpected compact operand kind." };
+        }
+    }
+}
+
+compact_instruction pack_instruction(const instruction& inst)
+{
+    static_assert(static_cast<uint32_t>(operation_type::count) <= UINT8_MAX);
+
+    if (inst.size > UINT8_MAX || static_cast<uint16_t>(inst.flags) > UINT8_MAX || inst.segment_override > UINT8_MAX)
+        throw std::runtime_error{ "Instruction cannot be represented in compact form." };
+
+    return compact_instruction
+    {
+        .operands = { pack_operand(inst.operands[0]), pack_operand(inst.operands[1]) },
+        .size = static_cast<uint8_t>(inst.size),
+        .op = static_cast<uint8_t>(inst.op),
+        .flags = static_cast<uint8_t>(inst.flags),
+        .segment_override = static_cast<uint8_t>(inst.segment_override)
+    };
+}
+
+instruction unpack_instruction(const compact_instruction& packed, uint32_t address)
+{
+    return instruction
+    {
+        .address = address,
+        .size = packed.size,
+        .op = operation_type{ packed.op },
+        .flags = instruction_flags{ packed.flags },
+        .operands = { unpack_operand(packed.operands[0]), unpack_operand(packed.operands[1]) },
+        .segment_override = packed.segment_override
+    };
+}
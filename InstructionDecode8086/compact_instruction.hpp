@@ -0,0 +1,64 @@
+﻿#ifndef WS_COMPACTINSTRUCTION_HPP
+#define WS_COMPACTINSTRUCTION_HPP
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+#include "register_access.hpp"
+
+struct instruction;
+
+enum class compact_operand_kind : uint8_t
+{
+    none,
+    effective_address,
+    direct_address,
+    register_access,
+    immediate
+};
+
+inline constexpr uint8_t no_compact_register = 0xFF;
+
+// register index, offset and count packed into the low seven bits of a byte
+constexpr uint8_t pack_register(register_access reg)
+{
+    return static_cast<uint8_t>(reg.index | (reg.offset << 4) | (reg.count << 5));
+}
+
+constexpr register_access unpack_register(uint8_t packed)
+{
+    return register_access
+    {
+        .index = static_cast<register_index>(packed & 0b1111),
+        .offset = (packed >> 4) & 1u,
+        .count = (packed >> 5) & 0b11u
+    };
+}
+
+struct compact_operand
+{
+    uint16_t value{}; // displacement, direct address or immediate
+    compact_operand_kind kind{};
+    uint8_t reg{ no_compact_register }; // packed register, or the first term of an effective address
+    uint8_t extra{ no_compact_register }; // second term of an effective address, or immediate flags
+};
+
+// packed form of a decoded instruction, without its address, for keeping large numbers of them in memory
+struct compact_instruction
+{
+    std::array<compact_operand, 2> operands{};
+    uint8_t size{};
+    uint8_t op{};
+    uint8_t flags{};
+    uint8_t segment_override{};
+};
+
+static_assert(sizeof(compact_instruction) <= 16);
+static_assert(std::is_trivially_copyable_v<compact_instruction>);
+
+compact_instruction pack_instruction(const instruction& inst);
+
+instruction unpack_instruction(const compact_instruction& packed, uint32_t address);
+
+#endif
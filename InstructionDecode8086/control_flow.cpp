@@ -0,0 +1,213 @@
+﻿#include "control_flow.hpp"
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include <iterator>
+#include <string_view>
+#include <variant>
+
+#include "decoder.hpp"
+#include "formatter.hpp"
+
+namespace
+{
+    enum class branch_kind
+    {
+        none,
+        conditional,
+        unconditional,
+        indirect
+    };
+
+    branch_kind get_branch_kind(const instruction& inst)
+    {
+        if (inst.op >= operation_type::je && inst.op <= operation_type::jcxz)
+            return branch_kind::conditional;
+
+        if (inst.op == operation_type::jmp)
+            return std::holds_alternative<immediate>(inst.operands[0]) ? branch_kind::unconditional : branch_kind::indirect;
+
+        return branch_kind::none;
+    }
+
+    // where a relative jump lands, with ip wrapping around the segment like it does when simulated
+    uint32_t get_jump_target(const instruction& inst)
+    {
+        const auto& displacement = std::get<immediate>(inst.operands[0]);
+        return static_cast<uint16_t>(inst.address + inst.size + displacement.value);
+    }
+
+    instruction decode_at(std::span<uint8_t> code, uint32_t address)
+    {
+        auto data_iter = code.begin() + address;
+        return decode_instruction(data_iter, code.end(), address);
+    }
+
+    // every address a block starts at, found by following each path until it ends or meets a path already followed
+    std::vector<bool> find_leaders(std::span<uint8_t> code)
+    {
+        std::vector<bool> leaders(code.size());
+        std::vector<bool> visited(code.size());
+        std::vector<uint32_t> pending = { 0 };
+
+        const auto add_leader = [&](uint32_t address)
+        {
+            if (address >= code.size() || leaders[address])
+                return;
+
+            leaders[address] = true;
+            pending.push_back(address);
+        };
+
+        leaders[0] = !code.empty();
+
+        while (!pending.empty())
+        {
+            uint32_t address = pending.back();
+            pending.pop_back();
+
+            while (address < code.size() && !visited[address])
+            {
+                visited[address] = true;
+
+                const instruction inst = decode_at(code, address);
+                const branch_kind kind = get_branch_kind(inst);
+                address += inst.size;
+
+                if (kind == branch_kind::none)
+                    continue;
+
+                if (kind != branch_kind::indirect)
+                    add_leader(get_jump_target(inst));
+
+                if (kind == branch_kind::conditional)
+                    add_leader(address);
+
+                break;
+            }
+        }
+
+        return leaders;
+    }
+
+    // successor for control arriving at address, which is either a block start or past the end of the code
+    block_edge make_edge(const std::vector<uint32_t>& block_indexes, uint32_t address, bool taken)
+    {
+        return { .target = address < block_indexes.size() ? block_indexes[address] : exit_block, .taken = taken };
+    }
+
+    std::string get_block_name(const basic_block& block)
+    {
+        return std::format("block_{:04x}", block.start);
+    }
+}
+
+control_flow_graph build_control_flow_graph(std::span<uint8_t> code)
+{
+    const std::vector<bool> leaders = find_leaders(code);
+
+    // block index for each leader address, so edges can be resolved once every block exists
+    std::vector<uint32_t> block_indexes(code.size(), exit_block);
+    control_flow_graph graph;
+
+    for (uint32_t start = 0; start < code.size(); ++start)
+    {
+        if (!leaders[start])
+            continue;
+
+        block_indexes[start] = static_cast<uint32_t>(graph.blocks.size());
+        graph.blocks.emplace_back().start = start;
+    }
+
+    for (basic_block& block : graph.blocks)
+    {
+        uint32_t address = block.start;
+
+        // a block runs until a branch, the start of another block or the end of the code
+        do
+        {
+            const instruction inst = decode_at(code, address);
+            address += inst.size;
+            block.instructions.push_back(inst);
+
+            cycle_estimate estimate{};
+            if (try_estimate_cycles(inst, estimate))
+            {
+                block.cycles.min += estimate.base.min + estimate.ea;
+                block.cycles.max += estimate.base.max + estimate.ea;
+            }
+            else
+            {
+                block.timing_known = false;
+            }
+
+            const branch_kind kind = get_branch_kind(inst);
+            if (kind == branch_kind::indirect)
+            {
+                block.indirect_exit = true;
+                break;
+            }
+
+            if (kind != branch_kind::none)
+            {
+                if (kind == branch_kind::conditional)
+                    block.successors.push_back(make_edge(block_indexes, address, false));
+
+                block.successors.push_back(make_edge(block_indexes, get_jump_target(inst), true));
+                break;
+            }
+
+            if (address >= code.size() || leaders[address])
+            {
+                block.successors.push_back(make_edge(block_indexes, address, false));
+                break;
+            }
+        }
+        while (true);
+
+        block.end = address;
+    }
+
+    return graph;
+}
+
+std::string format_control_flow_dot(const control_flow_graph& graph)
+{
+    std::string dot = "digraph control_flow\n{\n    node [shape=box, fontname=\"Courier\"];\n";
+    bool uses_exit = false;
+
+    std::array<char, line_buffer_size> instruction_text{};
+
+    for (const basic_block& block : graph.blocks)
+    {
+        std::string cycles = block.timing_known ? std::format("{}", block.cycles.min) : std::string{ "?" };
+        if (block.timing_known && block.cycles.max != block.cycles.min)
+            cycles += std::format("..{}", block.cycles.max);
+
+        // left-justified lines, with the address range and cost as a heading
+        std::format_to(std::back_inserter(dot), "    {} [label=\"{:#06x}-{:#06x}: {} clocks\\l", get_block_name(block), block.start, block.end, cycles);
+
+        for (const instruction& inst : block.instructions)
+        {
+            const std::string_view text{ instruction_text.data(), format_instruction(instruction_text.data(), inst) };
+            std::format_to(std::back_inserter(dot), "{}\\l", text);
+        }
+
+        dot += "\"];\n";
+
+        for (const block_edge& edge : block.successors)
+        {
+            uses_exit |= edge.target == exit_block;
+
+            const std::string target = edge.target == exit_block ? "exit" : get_block_name(graph.blocks[edge.target]);
+            std::format_to(std::back_inserter(dot), "    {} -> {}{};\n", get_block_name(block), target, edge.taken ? " [label=\"taken\"]" : "");
+        }
+    }
+
+    if (uses_exit)
+        dot += "    exit [shape=oval];\n";
+
+    dot += "}\n";
+    return dot;
+}
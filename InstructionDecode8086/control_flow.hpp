@@ -0,0 +1,44 @@
+﻿#ifndef WS_CONTROLFLOW_HPP
+#define WS_CONTROLFLOW_HPP
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "cycle_estimator.hpp"
+#include "instruction.hpp"
+
+// successor index for leaving the program, which happens when ip reaches the end of the code
+inline constexpr uint32_t exit_block = UINT32_MAX;
+
+struct block_edge
+{
+    uint32_t target{}; // block index or exit_block
+    bool taken{};      // false for falling through to the next instruction
+};
+
+// straight-line code entered only at its first instruction and left only after its last
+struct basic_block
+{
+    uint32_t start{}; // ip offsets, with end one past the last instruction byte
+    uint32_t end{};
+    std::vector<instruction> instructions;
+    std::vector<block_edge> successors;
+    cycle_interval cycles{}; // with the branch at the end falling through for min and jumping for max
+    bool timing_known{ true };
+    bool indirect_exit{}; // ends in a jump whose target is only known at run time
+};
+
+// blocks in address order, with the entry point first
+struct control_flow_graph
+{
+    std::vector<basic_block> blocks;
+};
+
+// follows relative jumps from the start of the code instead of sweeping it, so bytes no path reaches are never decoded
+control_flow_graph build_control_flow_graph(std::span<uint8_t> code);
+
+std::string format_control_flow_dot(const control_flow_graph& graph);
+
+#endif
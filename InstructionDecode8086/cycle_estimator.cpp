@@ -1,11 +1,16 @@
 ﻿#include "cycle_estimator.hpp"
 
-#include <map>
-#include <tuple>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <variant>
 
 #include "instruction.hpp"
-#include "overloaded.hpp"
+#include "simulator.hpp"
+#include "zone_profiler.hpp"
 
 namespace
 {
@@ -15,199 +20,375 @@ namespace
         accumulator,
         register_access,
         memory,
-        immediate
+        immediate,
+
+        count
     };
 
+    constexpr size_t operand_type_count = static_cast<size_t>(operand_type::count);
+    constexpr size_t operation_type_count = static_cast<size_t>(operation_type::count);
+
     struct cycle_info
     {
         int32_t base_count{};
+        int32_t taken_count{}; // for conditional branches, where base_count is the cost of falling through
         int32_t transfers{};
         bool use_ea{};
         int8_t ea_index{};
+        bool known{ true };
+    };
+
+    struct cycle_entry
+    {
+        operation_type op{};
+        operand_type first{};
+        operand_type second{};
+        cycle_info info{};
     };
 
-    using cycle_map = std::map<std::tuple<operation_type, operand_type, operand_type>, cycle_info>;
+    constexpr size_t get_cycle_index(operation_type op, operand_type first, operand_type second)
+    {
+        return (static_cast<size_t>(op) * operand_type_count + static_cast<size_t>(first)) * operand_type_count + static_cast<size_t>(second);
+    }
 
-    cycle_map cycle_table
+    constexpr std::array cycle_entries =
     {
-        { { operation_type::mov, operand_type::memory, operand_type::accumulator }, { .base_count = 10, .transfers = 1 } },
-        { { operation_type::mov, operand_type::accumulator, operand_type::memory }, { .base_count = 10, .transfers = 1 } },
+        cycle_entry{ operation_type::mov, operand_type::memory, operand_type::accumulator, { .base_count = 10, .transfers = 1 } },
+        cycle_entry{ operation_type::mov, operand_type::accumulator, operand_type::memory, { .base_count = 10, .transfers = 1 } },
+
+        cycle_entry{ operation_type::mov, operand_type::register_access, operand_type::register_access, { .base_count = 2, .transfers = 0 } },
+        cycle_entry{ operation_type::mov, operand_type::accumulator, operand_type::accumulator, { .base_count = 2, .transfers = 0 } },
+        cycle_entry{ operation_type::mov, operand_type::accumulator, operand_type::register_access, { .base_count = 2, .transfers = 0 } },
+        cycle_entry{ operation_type::mov, operand_type::register_access, operand_type::accumulator, { .base_count = 2, .transfers = 0 } },
+
+        cycle_entry{ operation_type::mov, operand_type::register_access, operand_type::memory, { .base_count = 8, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::mov, operand_type::memory, operand_type::register_access, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 0 } },
+
+        cycle_entry{ operation_type::mov, operand_type::register_access, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::mov, operand_type::accumulator, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
 
-        { { operation_type::mov, operand_type::register_access, operand_type::register_access }, { .base_count = 2, .transfers = 0 } },
-        { { operation_type::mov, operand_type::accumulator, operand_type::accumulator }, { .base_count = 2, .transfers = 0 } },
-        { { operation_type::mov, operand_type::accumulator, operand_type::register_access }, { .base_count = 2, .transfers = 0 } },
-        { { operation_type::mov, operand_type::register_access, operand_type::accumulator }, { .base_count = 2, .transfers = 0 } },
+        cycle_entry{ operation_type::mov, operand_type::memory, operand_type::immediate, { .base_count = 10, .transfers = 1, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::mov, operand_type::register_access, operand_type::memory }, { .base_count = 8, .transfers = 1, .use_ea = true, .ea_index = 1 } },
-        { { operation_type::mov, operand_type::memory, operand_type::register_access }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::add, operand_type::register_access, operand_type::register_access, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::add, operand_type::accumulator, operand_type::accumulator, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::add, operand_type::accumulator, operand_type::register_access, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::add, operand_type::register_access, operand_type::accumulator, { .base_count = 3, .transfers = 0 } },
 
-        { { operation_type::mov, operand_type::register_access, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
-        { { operation_type::mov, operand_type::accumulator, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::add, operand_type::register_access, operand_type::memory, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::add, operand_type::accumulator, operand_type::memory, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
 
-        { { operation_type::mov, operand_type::memory, operand_type::immediate }, { .base_count = 10, .transfers = 1, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::add, operand_type::memory, operand_type::register_access, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::add, operand_type::memory, operand_type::accumulator, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::add, operand_type::register_access, operand_type::register_access }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::add, operand_type::accumulator, operand_type::accumulator }, { .base_count = 3, .transfers = 0  } },
-        { { operation_type::add, operand_type::accumulator, operand_type::register_access }, { .base_count = 3, .transfers = 0  } },
-        { { operation_type::add, operand_type::register_access, operand_type::accumulator }, { .base_count = 3, .transfers = 0  } },
+        cycle_entry{ operation_type::add, operand_type::register_access, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::add, operand_type::accumulator, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
 
-        { { operation_type::add, operand_type::register_access, operand_type::memory }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
-        { { operation_type::add, operand_type::accumulator, operand_type::memory }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::add, operand_type::memory, operand_type::immediate, { .base_count = 17, .transfers = 2, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::add, operand_type::memory, operand_type::register_access }, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
-        { { operation_type::add, operand_type::memory, operand_type::accumulator }, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::register_access, operand_type::register_access, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::accumulator, operand_type::accumulator, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::accumulator, operand_type::register_access, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::register_access, operand_type::accumulator, { .base_count = 3, .transfers = 0 } },
 
-        { { operation_type::add, operand_type::register_access, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
-        { { operation_type::add, operand_type::accumulator, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::register_access, operand_type::memory, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::sub, operand_type::accumulator, operand_type::memory, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
 
-        { { operation_type::add, operand_type::memory, operand_type::immediate }, { .base_count = 17, .transfers = 2, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::memory, operand_type::register_access, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::memory, operand_type::accumulator, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::sub, operand_type::register_access, operand_type::register_access }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::sub, operand_type::accumulator, operand_type::accumulator }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::sub, operand_type::accumulator, operand_type::register_access }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::sub, operand_type::register_access, operand_type::accumulator }, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::register_access, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::sub, operand_type::accumulator, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
 
-        { { operation_type::sub, operand_type::register_access, operand_type::memory }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
-        { { operation_type::sub, operand_type::accumulator, operand_type::memory }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::sub, operand_type::memory, operand_type::immediate, { .base_count = 17, .transfers = 2, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::sub, operand_type::memory, operand_type::register_access }, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
-        { { operation_type::sub, operand_type::memory, operand_type::accumulator }, { .base_count = 16, .transfers = 2, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::register_access, operand_type::register_access, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::accumulator, operand_type::accumulator, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::accumulator, operand_type::register_access, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::register_access, operand_type::accumulator, { .base_count = 3, .transfers = 0 } },
 
-        { { operation_type::sub, operand_type::register_access, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
-        { { operation_type::sub, operand_type::accumulator, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::register_access, operand_type::memory, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::cmp, operand_type::accumulator, operand_type::memory, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
 
-        { { operation_type::sub, operand_type::memory, operand_type::immediate }, { .base_count = 17, .transfers = 2, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::memory, operand_type::register_access, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::memory, operand_type::accumulator, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::cmp, operand_type::register_access, operand_type::register_access }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::cmp, operand_type::accumulator, operand_type::accumulator }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::cmp, operand_type::accumulator, operand_type::register_access }, { .base_count = 3, .transfers = 0 } },
-        { { operation_type::cmp, operand_type::register_access, operand_type::accumulator }, { .base_count = 3, .transfers = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::register_access, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::cmp, operand_type::accumulator, operand_type::immediate, { .base_count = 4, .transfers = 0 } },
 
-        { { operation_type::cmp, operand_type::register_access, operand_type::memory }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
-        { { operation_type::cmp, operand_type::accumulator, operand_type::memory }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 1 } },
+        cycle_entry{ operation_type::cmp, operand_type::memory, operand_type::immediate, { .base_count = 10, .transfers = 1, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::cmp, operand_type::memory, operand_type::register_access }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 0 } },
-        { { operation_type::cmp, operand_type::memory, operand_type::accumulator }, { .base_count = 9, .transfers = 1, .use_ea = true, .ea_index = 0 } },
+        cycle_entry{ operation_type::je, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jl, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jle, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jb, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jbe, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jp, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jo, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::js, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jne, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jnl, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jg, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jnb, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::ja, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jnp, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jno, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
+        cycle_entry{ operation_type::jns, operand_type::immediate, operand_type::none, { .base_count = 4, .taken_count = 16 } },
 
-        { { operation_type::cmp, operand_type::register_access, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
-        { { operation_type::cmp, operand_type::accumulator, operand_type::immediate }, { .base_count = 4, .transfers = 0 } },
+        cycle_entry{ operation_type::loop, operand_type::immediate, operand_type::none, { .base_count = 5, .taken_count = 17 } },
+        cycle_entry{ operation_type::loopz, operand_type::immediate, operand_type::none, { .base_count = 6, .taken_count = 18 } },
+        cycle_entry{ operation_type::loopnz, operand_type::immediate, operand_type::none, { .base_count = 5, .taken_count = 19 } },
+        cycle_entry{ operation_type::jcxz, operand_type::immediate, operand_type::none, { .base_count = 6, .taken_count = 18 } },
 
-        { { operation_type::cmp, operand_type::memory, operand_type::immediate }, { .base_count = 10, .transfers = 1, .use_ea = true, .ea_index = 0 } },
+        // unconditional, so the cost is the same either way
+        cycle_entry{ operation_type::jmp, operand_type::immediate, operand_type::none, { .base_count = 15, .taken_count = 15 } },
+        cycle_entry{ operation_type::jmp, operand_type::register_access, operand_type::none, { .base_count = 11, .taken_count = 11 } },
+        cycle_entry{ operation_type::jmp, operand_type::accumulator, operand_type::none, { .base_count = 11, .taken_count = 11 } },
+        cycle_entry{ operation_type::jmp, operand_type::memory, operand_type::none, { .base_count = 18, .taken_count = 18, .transfers = 1, .use_ea = true, .ea_index = 0 } },
 
-        { { operation_type::nop, operand_type::none, operand_type::none }, { .base_count = 3, .transfers = 0 } }
+        cycle_entry{ operation_type::nop, operand_type::none, operand_type::none, { .base_count = 3, .transfers = 0 } }
     };
 
-    // bx, bp, si, di, disp
-    using ea_map = std::map<std::tuple<bool, bool, bool, bool, bool>, int8_t>;
+    // jmp far [address] also loads cs, so it reads two words; the operand types alone cannot tell it from a near jmp
+    constexpr cycle_info far_indirect_jmp_info{ .base_count = 24, .taken_count = 24, .transfers = 2, .use_ea = true, .ea_index = 0 };
 
-    ea_map ea_table
+    // every operation and operand type combination, with the ones missing from cycle_entries marked unknown
+    constexpr auto cycle_table = []
+    {
+        std::array<cycle_info, operation_type_count * operand_type_count * operand_type_count> table{};
+
+        for (cycle_info& info : table)
+            info.known = false;
+
+        for (const auto& [op, first, second, info] : cycle_entries)
+            table[get_cycle_index(op, first, second)] = info;
+
+        return table;
+    }();
+
+    static_assert([]
+    {
+        size_t known_count = 0;
+        for (const cycle_info& info : cycle_table)
+            known_count += info.known;
+
+        return known_count == cycle_entries.size();
+    }(), "Cycle entries must not repeat an operation and operand combination.");
+
+    // every register or accumulator and memory combination of the arithmetic operations, as the decoder can produce them
+    static_assert([]
+    {
+        constexpr std::array operations = { operation_type::mov, operation_type::add, operation_type::sub, operation_type::cmp };
+        constexpr std::array destinations = { operand_type::accumulator, operand_type::register_access, operand_type::memory };
+        constexpr std::array sources = { operand_type::accumulator, operand_type::register_access, operand_type::memory, operand_type::immediate };
+
+        for (const operation_type op : operations)
+        {
+            for (const operand_type first : destinations)
+            {
+                for (const operand_type second : sources)
+                {
+                    const bool memory_to_memory = (first == operand_type::memory && second == operand_type::memory);
+                    if (!memory_to_memory && !cycle_table[get_cycle_index(op, first, second)].known)
+                        return false;
+                }
+            }
+        }
+
+        return cycle_table[get_cycle_index(operation_type::nop, operand_type::none, operand_type::none)].known;
+    }(), "Every operand combination of mov, add, sub and cmp needs a cycle entry.");
+
+    // every relative branch, from je through jmp
+    static_assert([]
+    {
+        for (auto op = static_cast<size_t>(operation_type::je); op <= static_cast<size_t>(operation_type::jmp); ++op)
+        {
+            const cycle_info& info = cycle_table[get_cycle_index(static_cast<operation_type>(op), operand_type::immediate, operand_type::none)];
+            if (!info.known || info.taken_count < info.base_count)
+                return false;
+        }
+
+        return true;
+    }(), "Every branch needs a cycle entry with a taken cost of at least its fall-through cost.");
+
+    // bits of the effective address table index
+    enum ea_terms : uint8_t
+    {
+        ea_bx = 1 << 0,
+        ea_bp = 1 << 1,
+        ea_si = 1 << 2,
+        ea_di = 1 << 3,
+        ea_disp = 1 << 4,
+
+        ea_term_combinations = 1 << 5
+    };
+
+    constexpr int8_t unknown_ea = -1;
+
+    struct ea_entry
+    {
+        uint8_t terms{};
+        int8_t cycles{};
+    };
+
+    constexpr std::array ea_entries =
     {
         // displacement only
-        { { false, false, false, false, true }, 6 }, // disp
+        ea_entry{ ea_disp, 6 },
 
         // base or index only
-        { { true, false, false, false, false }, 5 }, // bx
-        { { false, true, false, false, false }, 5 }, // bp
-        { { false, false, true, false, false }, 5 }, // si
-        { { false, false, false, true, false }, 5 }, // di
+        ea_entry{ ea_bx, 5 },
+        ea_entry{ ea_bp, 5 },
+        ea_entry{ ea_si, 5 },
+        ea_entry{ ea_di, 5 },
 
         // displacement + base or index
-        { { true, false, false, false, true }, 9 }, // bx + disp
-        { { false, true, false, false, true }, 9 }, // bp + disp
-        { { false, false, true, false, true }, 9 }, // si + disp
-        { { false, false, false, true, true }, 9 }, // di + disp
+        ea_entry{ ea_bx | ea_disp, 9 },
+        ea_entry{ ea_bp | ea_disp, 9 },
+        ea_entry{ ea_si | ea_disp, 9 },
+        ea_entry{ ea_di | ea_disp, 9 },
 
         // base + index
-        { { true, false, true, false, false }, 7 }, // bx + si
-        { { true, false, false, true, false }, 8 }, // bx + di
-        { { false, true, true, false, false }, 8 }, // bp + si
-        { { false, true, false, true, false }, 7 }, // bp + di
+        ea_entry{ ea_bx | ea_si, 7 },
+        ea_entry{ ea_bx | ea_di, 8 },
+        ea_entry{ ea_bp | ea_si, 8 },
+        ea_entry{ ea_bp | ea_di, 7 },
 
         // displacement + base + index
-        { { true, false, true, false, true }, 11 }, // bx + si + disp
-        { { true, false, false, true, true }, 12 }, // bx + di + disp
-        { { false, true, true, false, true }, 12 }, // bp + si + disp
-        { { false, true, false, true, true }, 11 }, // bp + di + disp
+        ea_entry{ ea_bx | ea_si | ea_disp, 11 },
+        ea_entry{ ea_bx | ea_di | ea_disp, 12 },
+        ea_entry{ ea_bp | ea_si | ea_disp, 12 },
+        ea_entry{ ea_bp | ea_di | ea_disp, 11 }
     };
 
-    operand_type get_operand_type(const instruction_operand& operand)
+    constexpr auto ea_table = []
     {
-        auto matcher = overloaded
+        std::array<int8_t, ea_term_combinations> table{};
+        table.fill(unknown_ea);
+
+        for (const auto& [terms, cycles] : ea_entries)
+            table[terms] = cycles;
+
+        return table;
+    }();
+
+    // an 8086 address has at most one base (bx or bp) and one index (si or di), and at least one term
+    static_assert([]
+    {
+        for (uint8_t terms = 0; terms < ea_term_combinations; ++terms)
         {
-            [](const effective_address_expression&) { return operand_type::memory; },
-            [](direct_address) { return operand_type::memory; },
-            [](register_access reg_access)
-            {
-                const register_types reg_type = get_register_types(reg_access);
+            const bool two_bases = (terms & ea_bx) && (terms & ea_bp);
+            const bool two_indexes = (terms & ea_si) && (terms & ea_di);
+            const bool possible = !two_bases && !two_indexes && terms != 0;
 
-                if (has_any_flag(reg_type, register_types::ax | register_types::ah | register_types::al))
-                    return operand_type::accumulator;
+            if (possible != (ea_table[terms] != unknown_ea))
+                return false;
+        }
 
-                return operand_type::register_access;
-            },
-            [](immediate) { return operand_type::immediate; },
-            [](std::monostate) { return operand_type::none; }
-        };
+        return true;
+    }(), "The effective address table must cover exactly the possible address forms.");
 
-        return std::visit(matcher, operand);
-    }
-}
+    // ea_terms bit for each register index
+    constexpr std::array<uint8_t, register_count> ea_register_terms = { 0, ea_bx, 0, 0, 0, ea_bp, ea_si, ea_di };
 
-cycle_estimate estimate_cycles(const instruction& inst)
-{
-    operation_type opcode = inst.op;
-    operand_type first_operand_type = get_operand_type(inst.operands[0]);
-    operand_type second_operand_type = get_operand_type(inst.operands[1]);
+    // operand type for each instruction_operand alternative, with registers refined below
+    constexpr std::array<operand_type, std::variant_size_v<instruction_operand>> operand_types =
+    {
+        operand_type::none,
+        operand_type::memory,
+        operand_type::memory,
+        operand_type::register_access,
+        operand_type::immediate
+    };
 
-    const std::tuple cycle_key = { opcode, first_operand_type, second_operand_type };
+    static_assert(std::is_same_v<std::variant_alternative_t<1, instruction_operand>, effective_address_expression>
+        && std::is_same_v<std::variant_alternative_t<2, instruction_operand>, direct_address>
+        && std::is_same_v<std::variant_alternative_t<3, instruction_operand>, register_access>
+        && std::is_same_v<std::variant_alternative_t<4, instruction_operand>, immediate>,
+        "operand_types must follow the order of instruction_operand.");
 
-    if (!cycle_table.contains(cycle_key))
-        throw std::exception{ "Unexpected instruction for cycle estimation." };
+    operand_type get_operand_type(const instruction_operand& operand)
+    {
+        const operand_type type = operand_types[operand.index()];
 
-    const auto [base_cycles, transfers, use_ea, ea_index] = cycle_table[cycle_key];
+        // al, ah and ax
+        if (const auto* reg_access = std::get_if<register_access>(&operand); reg_access != nullptr && reg_access->index == 0)
+            return operand_type::accumulator;
 
-    int8_t ea_cycles = 0;
-    if (use_ea)
+        return type;
+    }
+
+    int8_t get_ea_cycles(const instruction_operand& operand)
     {
-        instruction_operand address_operand = inst.operands[ea_index];
+        uint8_t terms = 0;
 
-        auto matcher = overloaded
+        if (const auto* eae = std::get_if<effective_address_expression>(&operand))
         {
-            [](const effective_address_expression& eae)
-            {
-                const register_types term1_reg_type = get_register_types(eae.term1.reg);
-                const register_types term2_reg_type = eae.term2.has_value() ? get_register_types(eae.term2->reg) : register_types::none;
-                const register_types eae_reg_types = term1_reg_type | term2_reg_type;
+            terms = ea_register_terms[eae->term1.reg.index];
 
-                bool bx = has_any_flag(eae_reg_types, register_types::bx);
-                bool bp = has_any_flag(eae_reg_types, register_types::bp);
-                bool si = has_any_flag(eae_reg_types, register_types::si);
-                bool di = has_any_flag(eae_reg_types, register_types::di);
-                const bool disp = (eae.displacement != 0);
+            if (eae->term2.has_value())
+                terms |= ea_register_terms[eae->term2->reg.index];
 
-                const std::tuple ea_key = { bx, bp, si, di, disp };
+            if (eae->displacement != 0)
+                terms |= ea_disp;
+        }
+        else if (std::holds_alternative<direct_address>(operand))
+        {
+            terms = ea_disp;
+        }
+        else
+        {
+            return 0;
+        }
 
-                if (!ea_table.contains(ea_key))
-                    throw std::exception{ "Unexpected effective address expression for cycle estimation." };
+        const int8_t cycles = ea_table[terms];
+        if (cycles == unknown_ea)
+            throw std::runtime_error{ "Unexpected effective address expression for cycle estimation." };
 
-                return ea_table[ea_key];
-            },
-            [](direct_address)
-            {
-                return ea_table[{ false, false, false, false, true }];
-            },
-            [](register_access) { return int8_t{ 0 }; },
-            [](immediate) { return int8_t{ 0 }; },
-            [](std::monostate) { return int8_t{ 0 }; }
-        };
-
-        ea_cycles = std::visit(matcher, address_operand);
+        return cycles;
     }
+}
 
-    return cycle_estimate
+cycle_estimate estimate_cycles(const instruction& inst)
+{
+    cycle_estimate estimate{};
+
+    if (!try_estimate_cycles(inst, estimate))
+        throw std::runtime_error{ "Unexpected instruction for cycle estimation." };
+
+    return estimate;
+}
+
+bool try_estimate_cycles(const instruction& inst, cycle_estimate& estimate)
+{
+    PROFILE_ZONE("estimate_cycles");
+
+    const operand_type first_operand_type = get_operand_type(inst.operands[0]);
+    const operand_type second_operand_type = get_operand_type(inst.operands[1]);
+
+    const bool far_indirect_jmp = inst.op == operation_type::jmp && first_operand_type == operand_type::memory && has_any_flag(inst.flags, instruction_flags::far);
+    const cycle_info& info = far_indirect_jmp ? far_indirect_jmp_info : cycle_table[get_cycle_index(inst.op, first_operand_type, second_operand_type)];
+
+    if (!info.known)
+        return false;
+
+    const int8_t ea_cycles = info.use_ea ? get_ea_cycles(inst.operands[info.ea_index]) : 0;
+
+    estimate = cycle_estimate
     {
-        .base = { .min = base_cycles, .max = base_cycles },
-        .transfers = transfers,
+        .base = { .min = info.base_count, .max = std::max(info.base_count, info.taken_count) },
+        .transfers = info.transfers,
         .ea = ea_cycles
     };
+
+    return true;
+}
+
+int32_t get_transfer_penalty(const cycle_estimate& estimate, cpu_model model, bool wide, uint32_t address)
+{
+    constexpr int32_t cycles_per_split_transfer = 4;
+
+    // the 8086 only splits words that start at an odd address
+    const bool split = wide && (model == cpu_model::i8088 || (address & 1) != 0);
+
+    return split ? estimate.transfers * cycles_per_split_transfer : 0;
 }
@@ -5,6 +5,13 @@
 
 struct instruction;
 
+// the 8088 has an 8-bit data bus, so it moves every word a byte at a time
+enum class cpu_model : uint8_t
+{
+    i8086,
+    i8088
+};
+
 struct cycle_interval
 {
     int32_t min{};
@@ -13,6 +20,7 @@ struct cycle_interval
 
 struct cycle_estimate
 {
+    // for branches, min is the cost of falling through and max the cost of jumping
     cycle_interval base{};
     int32_t transfers{};
     int32_t ea{};
@@ -20,4 +28,10 @@ struct cycle_estimate
 
 cycle_estimate estimate_cycles(const instruction& inst);
 
+// returns false instead of throwing for instructions without known timing
+bool try_estimate_cycles(const instruction& inst, cycle_estimate& estimate);
+
+// extra cycles for word transfers the bus has to split in two, given where the memory operand actually was
+int32_t get_transfer_penalty(const cycle_estimate& estimate, cpu_model model, bool wide, uint32_t address);
+
 #endif
@@ -0,0 +1,163 @@
+﻿#include "decode_cache.hpp"
+
+#include <algorithm>
+#include <span>
+#include <stdexcept>
+
+#include "decoder.hpp"
+
+namespace
+{
+    // opcode + mod/reg/rm + 16-bit displacement + 16-bit data
+    constexpr uint32_t max_instruction_size = 6;
+
+    // makes sure the slot for an address holds its current decoding, returning the entry index
+    uint32_t decode_slot(decode_cache& cache, memory_array& memory, uint32_t address)
+    {
+        if (address < cache.code_begin || address >= cache.code_end)
+            throw std::runtime_error{ "Instruction address is outside of the cached code range." };
+
+        decode_cache_slot& slot = cache.slots[address - cache.code_begin];
+
+        if (slot.valid)
+            return slot.entry_index;
+
+        std::span<uint8_t> code{ memory.data() + address, memory.data() + cache.code_end };
+        auto data_iter = code.begin();
+        const instruction decoded = decode_instruction(data_iter, code.end(), address);
+
+        // timing depends only on the decoded operation and operands, so it is worked out here rather than per step
+        cycle_annotation annotation{};
+        annotation.known = try_estimate_cycles(decoded, annotation.estimate);
+        annotation.cycles =
+        {
+            .min = annotation.estimate.base.min + annotation.estimate.ea,
+            .max = annotation.estimate.base.max + annotation.estimate.ea
+        };
+
+        // reuse the entry from a previous decoding of this address if one exists
+        if (slot.entry_index == no_cache_entry)
+        {
+            slot.entry_index = static_cast<uint32_t>(cache.entries.size());
+            cache.entries.emplace_back();
+            cache.instructions.emplace_back();
+            cache.annotations.emplace_back();
+            cache.threaded_ops.emplace_back();
+            cache.fused_ops.emplace_back();
+        }
+
+        // kept unpacked as well, since every step through the reference engine needs the whole instruction
+        cache.entries[slot.entry_index] = pack_instruction(decoded);
+        cache.instructions[slot.entry_index] = unpack_instruction(cache.entries[slot.entry_index], address);
+        cache.annotations[slot.entry_index] = annotation;
+
+        // only the threaded engines need a handler, so it is bound on first use
+        slot.valid = true;
+        slot.bound = false;
+        slot.fusion_checked = false;
+
+        return slot.entry_index;
+    }
+
+    const threaded_op& get_bound_op(decode_cache& cache, uint32_t address, uint32_t entry_index)
+    {
+        decode_cache_slot& slot = cache.slots[address - cache.code_begin];
+
+        // bound from the unpacked form, so the handler sees exactly what simulate_instruction would
+        if (!slot.bound)
+        {
+            cache.threaded_ops[entry_index] = bind_instruction(cache.instructions[entry_index], entry_index);
+            slot.bound = true;
+        }
+
+        return cache.threaded_ops[entry_index];
+    }
+}
+
+decode_cache create_decode_cache(uint32_t code_begin, uint32_t code_size)
+{
+    return decode_cache
+    {
+        .code_begin = code_begin,
+        .code_end = code_begin + code_size,
+        .slots = std::vector<decode_cache_slot>(code_size),
+        .entries = {},
+        .instructions = {},
+        .annotations = {},
+        .threaded_ops = {},
+        .fused_ops = {}
+    };
+}
+
+const instruction& fetch_instruction(decode_cache& cache, memory_array& memory, uint32_t address)
+{
+    return cache.instructions[decode_slot(cache, memory, address)];
+}
+
+const threaded_op& fetch_threaded_op(decode_cache& cache, memory_array& memory, uint32_t address)
+{
+    return get_bound_op(cache, address, decode_slot(cache, memory, address));
+}
+
+const threaded_op& fetch_fused_op(decode_cache& cache, memory_array& memory, uint32_t address)
+{
+    const uint32_t entry_index = decode_slot(cache, memory, address);
+    decode_cache_slot& slot = cache.slots[address - cache.code_begin];
+
+    if (!slot.fusion_checked)
+    {
+        const instruction& first = cache.instructions[entry_index];
+        const uint32_t next_address = address + first.size;
+
+        threaded_op fused{};
+
+        // only instructions that always fall through to the next one start a pair, so that one is never data
+        if (can_start_fused_pair(first) && next_address < cache.code_end)
+        {
+            const uint32_t next_index = decode_slot(cache, memory, next_address);
+            fused = bind_fused_pair(cache.instructions[entry_index], cache.instructions[next_index], entry_index);
+        }
+
+        cache.fused_ops[entry_index] = fused;
+        slot.fusion_checked = true;
+    }
+
+    const threaded_op& fused = cache.fused_ops[entry_index];
+    return fused.handler != nullptr ? fused : get_bound_op(cache, address, entry_index);
+}
+
+const cycle_annotation& get_cycle_annotation(const decode_cache& cache, uint32_t address)
+{
+    const cycle_annotation& annotation = cache.annotations[cache.slots[address - cache.code_begin].entry_index];
+
+    if (!annotation.known)
+        throw std::runtime_error{ "Unexpected instruction for cycle estimation." };
+
+    return annotation;
+}
+
+void invalidate_instructions(decode_cache& cache, memory_write write)
+{
+    if (write.count == 0)
+        return;
+
+    // any instruction that starts up to max_instruction_size - 1 bytes before the write may include the written bytes
+    const uint32_t write_end = write.address + write.count;
+    const uint32_t first = std::max(cache.code_begin, write.address - std::min(write.address, max_instruction_size - 1));
+    const uint32_t last = std::min(cache.code_end, write_end);
+
+    for (uint32_t address = first; address < last; ++address)
+        cache.slots[address - cache.code_begin].valid = false;
+
+    // a fused pair also covers the instruction after its first one, so it can start up to two instructions before the write
+    const uint32_t first_pair = std::max(cache.code_begin, write.address - std::min(write.address, 2 * max_instruction_size - 1));
+
+    for (uint32_t address = first_pair; address < last; ++address)
+        cache.slots[address - cache.code_begin].fusion_checked = false;
+}
+
+void invalidate_all_instructions(decode_cache& cache)
+{
+    for (decode_cache_slot& slot : cache.slots)
+        slot.valid = false;
+}
@@ -0,0 +1,63 @@
+﻿#ifndef WS_DECODECACHE_HPP
+#define WS_DECODECACHE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "compact_instruction.hpp"
+#include "cycle_estimator.hpp"
+#include "instruction.hpp"
+#include "simulator.hpp"
+#include "threaded_interpreter.hpp"
+
+inline constexpr uint32_t no_cache_entry = UINT32_MAX;
+
+struct decode_cache_slot
+{
+    uint32_t entry_index{ no_cache_entry };
+    bool valid{};
+    bool bound{}; // whether threaded_ops holds the handler for the current decoding
+    bool fusion_checked{}; // whether fused_ops holds the current pairing with the instruction after this one
+};
+
+// timing of a cached instruction, worked out once when it is decoded
+struct cycle_annotation
+{
+    cycle_estimate estimate{};
+    cycle_interval cycles{}; // including the effective address; min when a branch falls through and max when it jumps
+    bool known{};
+};
+
+// decoded instructions for a range of code, keyed by the physical address of their first byte
+struct decode_cache
+{
+    uint32_t code_begin{};
+    uint32_t code_end{};
+    std::vector<decode_cache_slot> slots;
+    std::vector<compact_instruction> entries;
+    std::vector<instruction> instructions; // each entry unpacked once when it is decoded, so steps do not rebuild it
+    std::vector<cycle_annotation> annotations;
+    std::vector<threaded_op> threaded_ops;
+    std::vector<threaded_op> fused_ops; // without a handler where the instruction does not start a fused pair
+};
+
+decode_cache create_decode_cache(uint32_t code_begin, uint32_t code_size);
+
+// the reference stays valid until an address that was never decoded before is decoded
+const instruction& fetch_instruction(decode_cache& cache, memory_array& memory, uint32_t address);
+
+// the same instruction bound to its threaded handler, decoding it first if needed
+const threaded_op& fetch_threaded_op(decode_cache& cache, memory_array& memory, uint32_t address);
+
+// the instruction fused with the branch after it when the two can be, otherwise the same as fetch_threaded_op
+const threaded_op& fetch_fused_op(decode_cache& cache, memory_array& memory, uint32_t address);
+
+// the timing of the instruction fetch_instruction last returned for this address; throws when it has no known timing
+const cycle_annotation& get_cycle_annotation(const decode_cache& cache, uint32_t address);
+
+void invalidate_instructions(decode_cache& cache, memory_write write);
+
+// for when memory changed wholesale, e.g. after restoring a snapshot
+void invalidate_all_instructions(decode_cache& cache);
+
+#endif
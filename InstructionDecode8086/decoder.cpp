@@ -1,12 +1,15 @@
 ﻿#include "decoder.hpp"
 
+#include <algorithm>
 #include <array>
-#include <exception>
-#include <utility>
-#include <unordered_map>
+#include <ranges>
+#include <stdexcept>
 #include <string>
+#include <utility>
 
+#include "flag_utils.hpp"
 #include "instruction.hpp"
+#include "zone_profiler.hpp"
 
 namespace
 {
@@ -27,36 +30,52 @@ namespace
 
     constexpr std::array<uint8_t, 4> segment_register_index_map = { 11, 8, 10, 9 };
 
-    std::unordered_map<operation_type, const char*> mnemonics
+    template<size_t TableSize, typename TKey, typename TValue, size_t EntryCount>
+    constexpr std::array<TValue, TableSize> make_lookup_table(const std::array<std::pair<TKey, TValue>, EntryCount>& entries)
+    {
+        std::array<TValue, TableSize> table{};
+
+        for (const auto& [key, value] : entries)
+            table[static_cast<size_t>(key)] = value;
+
+        return table;
+    }
+
+    constexpr std::array mnemonic_entries =
     {
-        { operation_type::mov, "mov" },
-        { operation_type::add, "add" },
-        { operation_type::sub, "sub" },
-        { operation_type::cmp, "cmp" },
-        { operation_type::je, "je" },
-        { operation_type::jl, "jl" },
-        { operation_type::jle, "jle" },
-        { operation_type::jb, "jb" },
-        { operation_type::jbe, "jbe" },
-        { operation_type::jp, "jp" },
-        { operation_type::jo, "jo" },
-        { operation_type::js, "js" },
-        { operation_type::jne, "jne" },
-        { operation_type::jnl, "jnl" },
-        { operation_type::jg, "jg" },
-        { operation_type::jnb, "jnb" },
-        { operation_type::ja, "ja" },
-        { operation_type::jnp, "jnp" },
-        { operation_type::jno, "jno" },
-        { operation_type::jns, "jns" },
-        { operation_type::loop, "loop" },
-        { operation_type::loopz, "loopz" },
-        { operation_type::loopnz, "loopnz" },
-        { operation_type::jcxz, "jcxz" },
-        { operation_type::jmp, "jmp" },
-        { operation_type::nop, "nop" }
+        std::pair{ operation_type::mov, "mov" },
+        std::pair{ operation_type::add, "add" },
+        std::pair{ operation_type::sub, "sub" },
+        std::pair{ operation_type::cmp, "cmp" },
+        std::pair{ operation_type::je, "je" },
+        std::pair{ operation_type::jl, "jl" },
+        std::pair{ operation_type::jle, "jle" },
+        std::pair{ operation_type::jb, "jb" },
+        std::pair{ operation_type::jbe, "jbe" },
+        std::pair{ operation_type::jp, "jp" },
+        std::pair{ operation_type::jo, "jo" },
+        std::pair{ operation_type::js, "js" },
+        std::pair{ operation_type::jne, "jne" },
+        std::pair{ operation_type::jnl, "jnl" },
+        std::pair{ operation_type::jg, "jg" },
+        std::pair{ operation_type::jnb, "jnb" },
+        std::pair{ operation_type::ja, "ja" },
+        std::pair{ operation_type::jnp, "jnp" },
+        std::pair{ operation_type::jno, "jno" },
+        std::pair{ operation_type::jns, "jns" },
+        std::pair{ operation_type::loop, "loop" },
+        std::pair{ operation_type::loopz, "loopz" },
+        std::pair{ operation_type::loopnz, "loopnz" },
+        std::pair{ operation_type::jcxz, "jcxz" },
+        std::pair{ operation_type::jmp, "jmp" },
+        std::pair{ operation_type::nop, "nop" }
     };
 
+    constexpr auto mnemonics = make_lookup_table<static_cast<size_t>(operation_type::count)>(mnemonic_entries);
+
+    static_assert(std::ranges::none_of(mnemonics | std::views::drop(1), [](const char* name) { return name == nullptr; }),
+        "Every operation type must have a mnemonic.");
+
     constexpr std::array<std::pair<register_access, std::optional<register_access>>, 8> effective_addresses =
     {
         std::pair{ register_access{1, 0, 2}, register_access{6, 0, 2} }, // bx + si
@@ -129,117 +148,248 @@ namespace
 
     using opcode_type = std::underlying_type_t<opcode>;
 
-    std::unordered_map<opcode, operation_type> opcode_translation
+    constexpr std::array opcode_translation_entries =
     {
-        { opcode::mov_normal, operation_type::mov },
-        { opcode::mov_immediate_to_register_or_memory, operation_type::mov },
-        { opcode::mov_immediate_to_register, operation_type::mov },
-        { opcode::mov_memory_to_accumulator, operation_type::mov },
-        { opcode::mov_accumulator_to_memory, operation_type::mov },
-        { opcode::mov_to_segment_register, operation_type::mov },
-        { opcode::mov_from_segment_register, operation_type::mov },
-
-        { opcode::add_normal, operation_type::add },
-        { opcode::add_immediate_to_register_or_memory, operation_type::add },
-        { opcode::add_immediate_to_accumulator, operation_type::add },
-
-        { opcode::sub_normal, operation_type::sub },
-        { opcode::sub_immediate_from_register_or_memory, operation_type::sub },
-        { opcode::sub_immediate_from_accumulator, operation_type::sub },
-
-        { opcode::cmp_normal, operation_type::cmp },
-        { opcode::cmp_immediate_with_register_or_memory, operation_type::cmp },
-        { opcode::cmp_immediate_with_accumulator, operation_type::cmp },
-
-        { opcode::je, operation_type::je },
-        { opcode::jl, operation_type::jl },
-        { opcode::jle, operation_type::jle },
-        { opcode::jb, operation_type::jb },
-        { opcode::jbe, operation_type::jbe },
-        { opcode::jp, operation_type::jp },
-        { opcode::jo, operation_type::jo },
-        { opcode::js, operation_type::js },
-        { opcode::jne, operation_type::jne },
-        { opcode::jnl, operation_type::jnl },
-        { opcode::jg, operation_type::jg },
-        { opcode::jnb, operation_type::jnb },
-        { opcode::ja, operation_type::ja },
-        { opcode::jnp, operation_type::jnp },
-        { opcode::jno, operation_type::jno },
-        { opcode::jns, operation_type::jns },
-        { opcode::loop, operation_type::loop },
-        { opcode::loopz, operation_type::loopz },
-        { opcode::loopnz, operation_type::loopnz },
-        { opcode::jcxz, operation_type::jcxz },
-
-        { opcode::jmp_direct, operation_type::jmp },
-        { opcode::jmp_direct_short, operation_type::jmp },
-        { opcode::jmp_indirect_near, operation_type::jmp },
-        { opcode::jmp_indirect_far, operation_type::jmp },
-  
-        { opcode::nop, operation_type::nop }
+        std::pair{ opcode::mov_normal, operation_type::mov },
+        std::pair{ opcode::mov_immediate_to_register_or_memory, operation_type::mov },
+        std::pair{ opcode::mov_immediate_to_register, operation_type::mov },
+        std::pair{ opcode::mov_memory_to_accumulator, operation_type::mov },
+        std::pair{ opcode::mov_accumulator_to_memory, operation_type::mov },
+        std::pair{ opcode::mov_to_segment_register, operation_type::mov },
+        std::pair{ opcode::mov_from_segment_register, operation_type::mov },
+
+        std::pair{ opcode::add_normal, operation_type::add },
+        std::pair{ opcode::add_immediate_to_register_or_memory, operation_type::add },
+        std::pair{ opcode::add_immediate_to_accumulator, operation_type::add },
+
+        std::pair{ opcode::sub_normal, operation_type::sub },
+        std::pair{ opcode::sub_immediate_from_register_or_memory, operation_type::sub },
+        std::pair{ opcode::sub_immediate_from_accumulator, operation_type::sub },
+
+        std::pair{ opcode::cmp_normal, operation_type::cmp },
+        std::pair{ opcode::cmp_immediate_with_register_or_memory, operation_type::cmp },
+        std::pair{ opcode::cmp_immediate_with_accumulator, operation_type::cmp },
+
+        std::pair{ opcode::je, operation_type::je },
+        std::pair{ opcode::jl, operation_type::jl },
+        std::pair{ opcode::jle, operation_type::jle },
+        std::pair{ opcode::jb, operation_type::jb },
+        std::pair{ opcode::jbe, operation_type::jbe },
+        std::pair{ opcode::jp, operation_type::jp },
+        std::pair{ opcode::jo, operation_type::jo },
+        std::pair{ opcode::js, operation_type::js },
+        std::pair{ opcode::jne, operation_type::jne },
+        std::pair{ opcode::jnl, operation_type::jnl },
+        std::pair{ opcode::jg, operation_type::jg },
+        std::pair{ opcode::jnb, operation_type::jnb },
+        std::pair{ opcode::ja, operation_type::ja },
+        std::pair{ opcode::jnp, operation_type::jnp },
+        std::pair{ opcode::jno, operation_type::jno },
+        std::pair{ opcode::jns, operation_type::jns },
+        std::pair{ opcode::loop, operation_type::loop },
+        std::pair{ opcode::loopz, operation_type::loopz },
+        std::pair{ opcode::loopnz, operation_type::loopnz },
+        std::pair{ opcode::jcxz, operation_type::jcxz },
+
+        std::pair{ opcode::jmp_direct, operation_type::jmp },
+        std::pair{ opcode::jmp_direct_short, operation_type::jmp },
+        std::pair{ opcode::jmp_indirect_near, operation_type::jmp },
+        std::pair{ opcode::jmp_indirect_far, operation_type::jmp },
+
+        std::pair{ opcode::nop, operation_type::nop }
     };
 
-    std::vector<std::unordered_map<uint8_t, opcode>> opcode_maps
+    constexpr auto opcode_translation = make_lookup_table<static_cast<size_t>(opcode::count)>(opcode_translation_entries);
+
+    // opcodes shared by several operations are translated after the reg field selects one of them
+    static_assert([]
     {
+        for (size_t i = 1; i < opcode_translation.size(); ++i)
         {
-            { 0b1000'1110, opcode::mov_to_segment_register },
-            { 0b1000'1100, opcode::mov_from_segment_register },
-
-            { 0b0111'0100, opcode::je },
-            { 0b0111'1100, opcode::jl },
-            { 0b0111'1110, opcode::jle },
-            { 0b0111'0010, opcode::jb },
-            { 0b0111'0110, opcode::jbe },
-            { 0b0111'1010, opcode::jp },
-            { 0b0111'0000, opcode::jo },
-            { 0b0111'1000, opcode::js },
-            { 0b0111'0101, opcode::jne },
-            { 0b0111'1101, opcode::jnl },
-            { 0b0111'1111, opcode::jg },
-            { 0b0111'0011, opcode::jnb },
-            { 0b0111'0111, opcode::ja },
-            { 0b0111'1011, opcode::jnp },
-            { 0b0111'0001, opcode::jno },
-            { 0b0111'1001, opcode::jns },
-            { 0b1110'0010, opcode::loop },
-            { 0b1110'0001, opcode::loopz },
-            { 0b1110'0000, opcode::loopnz },
-            { 0b1110'0011, opcode::jcxz },
-
-            { 0b1110'1001, opcode::jmp_direct },
-            { 0b1110'1011, opcode::jmp_direct_short },
-            { 0b1111'1111, opcode::jmp_indirect },
-
-            { 0b1001'0000, opcode::nop }
-        },
-        {
-            { 0b1100'011, opcode::mov_immediate_to_register_or_memory },
-            { 0b1010'000, opcode::mov_memory_to_accumulator },
-            { 0b1010'001, opcode::mov_accumulator_to_memory },
-
-            { 0b0000'010, opcode::add_immediate_to_accumulator },
-            { 0b0010'110, opcode::sub_immediate_from_accumulator },
-            { 0b0011'110, opcode::cmp_immediate_with_accumulator }
-        },
+            const auto op = opcode{ static_cast<opcode_type>(i) };
+            if (op != opcode::arithmetic_immediate && op != opcode::jmp_indirect && opcode_translation[i] == operation_type::none)
+                return false;
+        }
+
+        return true;
+    }(), "Every opcode must translate to an operation type.");
+
+    struct opcode_encoding
+    {
+        uint8_t pattern{};
+        uint8_t shift{}; // low bits of the first byte that hold fields rather than the opcode
+        opcode op{};
+    };
+
+    // ordered by shift so that longer opcodes take precedence over shorter ones
+    constexpr std::array opcode_encodings =
+    {
+        opcode_encoding{ 0b1000'1110, 0, opcode::mov_to_segment_register },
+        opcode_encoding{ 0b1000'1100, 0, opcode::mov_from_segment_register },
+
+        opcode_encoding{ 0b0111'0100, 0, opcode::je },
+        opcode_encoding{ 0b0111'1100, 0, opcode::jl },
+        opcode_encoding{ 0b0111'1110, 0, opcode::jle },
+        opcode_encoding{ 0b0111'0010, 0, opcode::jb },
+        opcode_encoding{ 0b0111'0110, 0, opcode::jbe },
+        opcode_encoding{ 0b0111'1010, 0, opcode::jp },
+        opcode_encoding{ 0b0111'0000, 0, opcode::jo },
+        opcode_encoding{ 0b0111'1000, 0, opcode::js },
+        opcode_encoding{ 0b0111'0101, 0, opcode::jne },
+        opcode_encoding{ 0b0111'1101, 0, opcode::jnl },
+        opcode_encoding{ 0b0111'1111, 0, opcode::jg },
+        opcode_encoding{ 0b0111'0011, 0, opcode::jnb },
+        opcode_encoding{ 0b0111'0111, 0, opcode::ja },
+        opcode_encoding{ 0b0111'1011, 0, opcode::jnp },
+        opcode_encoding{ 0b0111'0001, 0, opcode::jno },
+        opcode_encoding{ 0b0111'1001, 0, opcode::jns },
+        opcode_encoding{ 0b1110'0010, 0, opcode::loop },
+        opcode_encoding{ 0b1110'0001, 0, opcode::loopz },
+        opcode_encoding{ 0b1110'0000, 0, opcode::loopnz },
+        opcode_encoding{ 0b1110'0011, 0, opcode::jcxz },
+
+        opcode_encoding{ 0b1110'1001, 0, opcode::jmp_direct },
+        opcode_encoding{ 0b1110'1011, 0, opcode::jmp_direct_short },
+        opcode_encoding{ 0b1111'1111, 0, opcode::jmp_indirect },
+
+        opcode_encoding{ 0b1001'0000, 0, opcode::nop },
+
+        opcode_encoding{ 0b1100'011, 1, opcode::mov_immediate_to_register_or_memory },
+        opcode_encoding{ 0b1010'000, 1, opcode::mov_memory_to_accumulator },
+        opcode_encoding{ 0b1010'001, 1, opcode::mov_accumulator_to_memory },
+
+        opcode_encoding{ 0b0000'010, 1, opcode::add_immediate_to_accumulator },
+        opcode_encoding{ 0b0010'110, 1, opcode::sub_immediate_from_accumulator },
+        opcode_encoding{ 0b0011'110, 1, opcode::cmp_immediate_with_accumulator },
+
+        opcode_encoding{ 0b1000'10, 2, opcode::mov_normal },
+
+        opcode_encoding{ 0b0000'00, 2, opcode::add_normal },
+        opcode_encoding{ 0b0010'10, 2, opcode::sub_normal },
+        opcode_encoding{ 0b0011'10, 2, opcode::cmp_normal },
+        opcode_encoding{ 0b1000'00, 2, opcode::arithmetic_immediate },
+
+        opcode_encoding{ 0b1011, 4, opcode::mov_immediate_to_register }
+    };
+
+    enum class opcode_layout : uint8_t
+    {
+        none = 0,
+        follow_byte = 1 << 0,
+        displacement = 1 << 1,
+        data = 1 << 2,
+        register_in_opcode = 1 << 3,
+        always_wide = 1 << 4
+    };
+
+    FLAG_OPERATIONS(opcode_layout);
+
+    constexpr uint8_t no_bit = 0xFF;
+
+    struct opcode_info
+    {
+        opcode op{};
+        opcode_layout layout{};
+        uint8_t w_bit{ no_bit };
+        uint8_t d_bit{ no_bit };
+        uint8_t s_bit{ no_bit };
+    };
+
+    constexpr opcode_info get_opcode_info(opcode op)
+    {
+        constexpr auto modrm = opcode_layout::follow_byte | opcode_layout::displacement;
+
+        switch (op)
         {
-            { 0b1000'10, opcode::mov_normal },
-
-            { 0b0000'00, opcode::add_normal },
-            { 0b0010'10, opcode::sub_normal },
-            { 0b0011'10, opcode::cmp_normal },
-            { 0b1000'00, opcode::arithmetic_immediate }
-        },
-        {},
+            case opcode::mov_normal:
+            case opcode::add_normal:
+            case opcode::sub_normal:
+            case opcode::cmp_normal:
+                return { .op = op, .layout = modrm, .w_bit = 0, .d_bit = 1 };
+
+            case opcode::arithmetic_immediate:
+                return { .op = op, .layout = modrm | opcode_layout::data, .w_bit = 0, .s_bit = 1 };
+
+            case opcode::mov_immediate_to_register_or_memory:
+                return { .op = op, .layout = modrm | opcode_layout::data, .w_bit = 0 };
+
+            case opcode::mov_immediate_to_register:
+                return { .op = op, .layout = opcode_layout::register_in_opcode | opcode_layout::data, .w_bit = 3 };
+
+            case opcode::add_immediate_to_accumulator:
+            case opcode::sub_immediate_from_accumulator:
+            case opcode::cmp_immediate_with_accumulator:
+            case opcode::mov_memory_to_accumulator:
+            case opcode::mov_accumulator_to_memory:
+                return { .op = op, .layout = opcode_layout::data, .w_bit = 0 };
+
+            case opcode::mov_to_segment_register:
+            case opcode::mov_from_segment_register:
+                return { .op = op, .layout = modrm };
+
+            case opcode::jmp_direct:
+                return { .op = op, .layout = opcode_layout::data | opcode_layout::always_wide };
+
+            case opcode::jmp_indirect:
+                return { .op = op, .layout = modrm | opcode_layout::always_wide };
+
+            case opcode::je:
+            case opcode::jl:
+            case opcode::jle:
+            case opcode::jb:
+            case opcode::jbe:
+            case opcode::jp:
+            case opcode::jo:
+            case opcode::js:
+            case opcode::jne:
+            case opcode::jnl:
+            case opcode::jg:
+            case opcode::jnb:
+            case opcode::ja:
+            case opcode::jnp:
+            case opcode::jno:
+            case opcode::jns:
+            case opcode::loop:
+            case opcode::loopz:
+            case opcode::loopnz:
+            case opcode::jcxz:
+            case opcode::jmp_direct_short:
+                return { .op = op, .layout = opcode_layout::data };
+
+            case opcode::nop:
+                return { .op = op };
+
+            default:
+                return {};
+        }
+    }
+
+    // every possible first byte of an instruction, resolved to its opcode and field layout
+    constexpr std::array<opcode_info, 256> opcode_table = []
+    {
+        std::array<opcode_info, 256> table{};
+
+        for (size_t b = 0; b < table.size(); ++b)
         {
-            { 0b1011, opcode::mov_immediate_to_register }
+            const auto match = std::ranges::find_if(opcode_encodings, [b](const opcode_encoding& encoding) { return (b >> encoding.shift) == encoding.pattern; });
+
+            if (match != opcode_encodings.end())
+                table[b] = get_opcode_info(match->op);
         }
-    };
+
+        return table;
+    }();
+
+    static_assert(opcode_table[0b1000'1001].op == opcode::mov_normal);
+    static_assert(opcode_table[0b1000'0011].op == opcode::arithmetic_immediate);
+    static_assert(opcode_table[0b1011'1010].op == opcode::mov_immediate_to_register);
+    static_assert(opcode_table[0b1000'1110].op == opcode::mov_to_segment_register);
+    static_assert(opcode_table[0b1111'0100].op == opcode::none);
 
     struct instruction_fields
     {
         uint16_t size{};
-        opcode opcode{};
+        ::opcode opcode{}; // qualified because the member takes the name of its type
         uint8_t mod{};
         uint8_t reg{};
         uint8_t rm{};
@@ -252,17 +402,9 @@ namespace
         bool s{};
     };
 
-    opcode read_opcode(uint8_t b)
+    bool read_bit(uint8_t b, uint8_t bit)
     {
-        for (size_t i = 0; i < opcode_maps.size(); ++i)
-        {
-            std::unordered_map<uint8_t, opcode>& opcode_map = opcode_maps[i];
-
-            if (uint8_t key = b >> i; opcode_map.contains(key))
-                return opcode_map[key];
-        }
-
-        return opcode::none;
+        return bit != no_bit && ((b >> bit) & 1) != 0;
     }
 
     int8_t get_displacement_bytes(uint8_t mod, uint8_t rm)
@@ -278,14 +420,14 @@ namespace
             case 0b11: // register mode, no displacement
                 return 0;
             default:
-                throw std::exception{ "Unexpected mod value." };
+                throw std::runtime_error{ "Unexpected mod value." };
         }
     }
 
     void read_and_advance(data_iterator& iter, const data_iterator& iter_end, uint8_t& b)
     {
         if (iter >= iter_end)
-            throw std::exception{ "Cannot dereference out-of-range iterator for binary data." };
+            throw std::runtime_error{ "Cannot dereference out-of-range iterator for binary data." };
         
         b = *iter++;
     }
@@ -349,7 +491,7 @@ namespace
             case 2:
                 return static_cast<int16_t>((fields.disp_hi << 8) + fields.disp_lo);
             default:
-                throw std::exception{ "Unexpected displacement byte count." };
+                throw std::runtime_error{ "Unexpected displacement byte count." };
         }
     }
 
@@ -364,7 +506,7 @@ namespace
             case 2:
                 return static_cast<uint16_t>((fields.disp_hi << 8) + fields.disp_lo);
             default:
-                throw std::exception{ "Unexpected direct address byte count." };
+                throw std::runtime_error{ "Unexpected direct address byte count." };
         }
     }
 
@@ -387,7 +529,7 @@ namespace
                 displacement_bytes = 2;
                 break;
             default:
-                throw std::exception{ "Unexpected mod value.",  };
+                throw std::runtime_error{ "Unexpected mod value.",  };
         }
         
         if (directAddress)
@@ -435,11 +577,13 @@ namespace
 
     instruction decode_fields(const instruction_fields& fields, uint32_t address)
     {
+        PROFILE_FUNCTION();
+
         instruction inst
         {
             .address = address,
             .size = fields.size,
-            .op = opcode_translation[fields.opcode],
+            .op = opcode_translation[static_cast<size_t>(fields.opcode)],
             .flags = fields.w ? instruction_flags::wide : instruction_flags::none
         };
 
@@ -581,6 +725,10 @@ namespace
             case opcode::jmp_indirect_far:
             {
                 inst.operands[0] = get_address_operand(fields);
+
+                if (fields.opcode == opcode::jmp_indirect_far)
+                    inst.flags |= instruction_flags::far;
+
                 break;
             }
 
@@ -591,7 +739,7 @@ namespace
             case opcode::none:
             {
                 const std::string error_message = "Unrecognized opcode while decoding fields: " + std::to_string(static_cast<opcode_type>(fields.opcode));
-                throw std::exception{ error_message.c_str() };
+                throw std::runtime_error{ error_message.c_str() };
             }
         }
 
@@ -600,6 +748,8 @@ namespace
 
     instruction_fields read_fields(data_iterator& data_iter, const data_iterator& data_end)
     {
+        PROFILE_FUNCTION();
+
         const data_iterator initial_position = data_iter;
 
         instruction_fields fields{};
@@ -607,134 +757,58 @@ namespace
         uint8_t b = 0;
         read_and_advance(data_iter, data_end, b);
 
-        fields.opcode = read_opcode(b);
+        const opcode_info& info = opcode_table[b];
+        fields.opcode = info.op;
 
-        switch (fields.opcode)
+        if (fields.opcode == opcode::none)
         {
-            case opcode::mov_normal:
-            case opcode::add_normal:
-            case opcode::sub_normal:
-            case opcode::cmp_normal:
-            {
-                fields.w = b & 1;
-                b >>= 1;
-                fields.d = b & 1;
+            const std::string error_message = "Unrecognized opcode while reading fields: " + std::to_string(static_cast<opcode_type>(fields.opcode));
+            throw std::runtime_error{ error_message.c_str() };
+        }
 
-                read_follow_byte(data_iter, data_end, fields, b);
-                read_displacement(data_iter, data_end, fields);
-                break;
-            }
+        fields.w = has_any_flag(info.layout, opcode_layout::always_wide) || read_bit(b, info.w_bit);
+        fields.d = read_bit(b, info.d_bit);
+        fields.s = read_bit(b, info.s_bit);
 
-            case opcode::arithmetic_immediate:
-                fields.s = (b >> 1) & 1;
-                [[fallthrough]];
+        if (has_any_flag(info.layout, opcode_layout::register_in_opcode))
+            fields.reg = b & 0b111;
 
-            case opcode::mov_immediate_to_register_or_memory:
-            {
-                fields.w = b & 1;
-                read_follow_byte(data_iter, data_end, fields, b);
+        if (has_any_flag(info.layout, opcode_layout::follow_byte))
+        {
+            read_follow_byte(data_iter, data_end, fields, b);
 
-                if (fields.opcode == opcode::arithmetic_immediate)
+            if (fields.opcode == opcode::arithmetic_immediate)
+            {
+                fields.opcode = [&fields]
                 {
-                    fields.opcode = [&fields]
+                    switch (fields.reg)
                     {
-                        switch (fields.reg)
-                        {
-                            case 0b000: return opcode::add_immediate_to_register_or_memory;
-                            case 0b101: return opcode::sub_immediate_from_register_or_memory;
-                            case 0b111: return opcode::cmp_immediate_with_register_or_memory;
-                            default:    throw std::exception{ "Unexpected arithmetic op identifier." };
-                        }
-                    }();
-                }
-
-                read_displacement(data_iter, data_end, fields);
-                read_data(data_iter, data_end, fields);
-
-                break;
-            }
-
-            case opcode::mov_immediate_to_register:
-                fields.reg = b & 0b111;
-                b >>= 3;
-                [[fallthrough]];
-
-            case opcode::add_immediate_to_accumulator:
-            case opcode::sub_immediate_from_accumulator:
-            case opcode::cmp_immediate_with_accumulator:
-            case opcode::mov_memory_to_accumulator:
-            case opcode::mov_accumulator_to_memory:
-            {
-                fields.w = b & 1;
-                read_data(data_iter, data_end, fields);
-                break;
-            }
-
-            case opcode::mov_to_segment_register:
-            case opcode::mov_from_segment_register:
-            {
-                read_follow_byte(data_iter, data_end, fields, b);
-                read_displacement(data_iter, data_end, fields);
-                break;
-            }
-
-            case opcode::je:
-            case opcode::jl:
-            case opcode::jle:
-            case opcode::jb:
-            case opcode::jbe:
-            case opcode::jp:
-            case opcode::jo:
-            case opcode::js:
-            case opcode::jne:
-            case opcode::jnl:
-            case opcode::jg:
-            case opcode::jnb:
-            case opcode::ja:
-            case opcode::jnp:
-            case opcode::jno:
-            case opcode::jns:
-            case opcode::loop:
-            case opcode::loopz:
-            case opcode::loopnz:
-            case opcode::jcxz:
-            case opcode::jmp_direct:
-            case opcode::jmp_direct_short:
-            {
-                fields.w = (fields.opcode == opcode::jmp_direct);
-                read_data(data_iter, data_end, fields);
-                break;
+                        case 0b000: return opcode::add_immediate_to_register_or_memory;
+                        case 0b101: return opcode::sub_immediate_from_register_or_memory;
+                        case 0b111: return opcode::cmp_immediate_with_register_or_memory;
+                        default:    throw std::runtime_error{ "Unexpected arithmetic op identifier." };
+                    }
+                }();
             }
-
-            case opcode::jmp_indirect:
+            else if (fields.opcode == opcode::jmp_indirect)
             {
-                fields.w = true;
-                read_follow_byte(data_iter, data_end, fields, b);
-
                 fields.opcode = [&fields]
                 {
                     switch (fields.reg)
                     {
                         case 0b100: return opcode::jmp_indirect_near;
                         case 0b101: return opcode::jmp_indirect_far;
-                        default:    throw std::exception{ "Unexpected indirect unconditional jump identifier." };
+                        default:    throw std::runtime_error{ "Unexpected indirect unconditional jump identifier." };
                     }
                 }();
-
-                read_displacement(data_iter, data_end, fields);
-                break;
             }
+        }
 
-            case opcode::nop:
-                break;
+        if (has_any_flag(info.layout, opcode_layout::displacement))
+            read_displacement(data_iter, data_end, fields);
 
-            default:
-            case opcode::none:
-            {
-                const std::string error_message = "Unrecognized opcode while reading fields: " + std::to_string(static_cast<opcode_type>(fields.opcode));
-                throw std::exception{ error_message.c_str() };
-            }
-        }
+        if (has_any_flag(info.layout, opcode_layout::data))
+            read_data(data_iter, data_end, fields);
 
         const data_iterator final_position = data_iter;
         fields.size = static_cast<uint16_t>(std::distance(initial_position, final_position));
@@ -749,12 +823,7 @@ instruction decode_instruction(data_iterator& data_iter, const data_iterator& da
     return decode_fields(fields, address);
 }
 
-char const* get_register_name(const register_access& reg_access)
-{
-    return registers[reg_access.index][reg_access.offset + (reg_access.count == 1)];
-}
-
 char const* get_mneumonic(operation_type type)
 {
-    return mnemonics[type];
+    return mnemonics[static_cast<size_t>(type)];
 }
@@ -0,0 +1,27 @@
+﻿#include "execution_profile.hpp"
+
+#include <algorithm>
+
+execution_profile create_execution_profile(uint32_t code_size)
+{
+    return { .addresses = std::vector<address_profile>(code_size) };
+}
+
+std::vector<uint16_t> get_hot_addresses(const execution_profile& profile)
+{
+    std::vector<uint16_t> hot_addresses;
+
+    for (size_t ip = 0; ip < profile.addresses.size(); ++ip)
+    {
+        if (profile.addresses[ip].count != 0)
+            hot_addresses.push_back(static_cast<uint16_t>(ip));
+    }
+
+    // ties keep address order, so straight-line code reads top to bottom
+    std::ranges::stable_sort(hot_addresses, [&profile](uint16_t a, uint16_t b)
+    {
+        return profile.addresses[a].cycles > profile.addresses[b].cycles;
+    });
+
+    return hot_addresses;
+}
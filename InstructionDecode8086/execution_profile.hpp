@@ -0,0 +1,32 @@
+﻿#ifndef WS_EXECUTIONPROFILE_HPP
+#define WS_EXECUTIONPROFILE_HPP
+
+#include <cstdint>
+#include <vector>
+
+struct address_profile
+{
+    uint64_t count{};
+    int64_t cycles{};
+};
+
+// execution counts and estimated cycles for every instruction address, indexed by ip offset into the code
+struct execution_profile
+{
+    std::vector<address_profile> addresses;
+};
+
+execution_profile create_execution_profile(uint32_t code_size);
+
+// called once per executed instruction, so it only touches one flat array entry
+inline void record_profile_step(execution_profile& profile, uint16_t ip, int32_t cycles)
+{
+    address_profile& entry = profile.addresses[ip];
+    ++entry.count;
+    entry.cycles += cycles;
+}
+
+// ip offsets of every executed instruction, most expensive first
+std::vector<uint16_t> get_hot_addresses(const execution_profile& profile);
+
+#endif
@@ -0,0 +1,202 @@
+﻿#include "execution_trace.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+#include "compact_instruction.hpp"
+#include "flag_utils.hpp"
+
+namespace
+{
+    // file layout, all values little-endian:
+    //   magic, version
+    //   per step: field mask, then only the fields the mask names, in mask bit order
+    constexpr uint32_t trace_magic = 0x54363853; // "S86T"
+    constexpr uint32_t trace_version = 1;
+    constexpr size_t trace_buffer_size = 1024 * 1024;
+
+    enum class trace_fields : uint8_t
+    {
+        none = 0,
+        destination = 1 << 0, // packed register and old value
+        new_value = 1 << 1, // otherwise unchanged from the old value
+        old_ip = 1 << 2, // otherwise the previous step's new ip
+        long_jump = 1 << 3, // new ip as a word, otherwise a signed byte relative to the old ip
+        old_flags = 1 << 4, // otherwise the previous step's new flags
+        new_flags = 1 << 5, // otherwise unchanged from the old flags
+        write = 1 << 6 // memory write address, byte count and the bytes written
+    };
+
+    FLAG_OPERATIONS(trace_fields);
+
+    void append(std::vector<uint8_t>& buffer, uint32_t value, int byte_count)
+    {
+        for (int i = 0; i < byte_count; ++i)
+            buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    uint32_t read(trace_reader& reader, int byte_count)
+    {
+        if (reader.data.size() - reader.position < static_cast<size_t>(byte_count))
+            throw std::runtime_error{ "Trace file is truncated." };
+
+        uint32_t value = 0;
+        for (int i = 0; i < byte_count; ++i)
+            value |= static_cast<uint32_t>(reader.data[reader.position++]) << (8 * i);
+
+        return value;
+    }
+
+    void flush(trace_writer& writer)
+    {
+        writer.stream.write(reinterpret_cast<const char*>(writer.buffer.data()), static_cast<std::streamsize>(writer.buffer.size()));
+
+        if (!writer.stream)
+            throw std::runtime_error{ "Cannot write to trace file." };
+
+        writer.buffer.clear();
+    }
+}
+
+trace_writer open_trace_writer(const char* path)
+{
+    trace_writer writer
+    {
+        .stream = std::ofstream{ path, std::ios::binary },
+        .buffer = {}
+    };
+
+    if (!writer.stream)
+        throw std::runtime_error{ "Cannot open trace file for writing." };
+
+    writer.buffer.reserve(trace_buffer_size);
+    append(writer.buffer, trace_magic, 4);
+    append(writer.buffer, trace_version, 4);
+
+    return writer;
+}
+
+void write_trace_step(trace_writer& writer, const simulation_step& step)
+{
+    // the longest record: mask, destination, two values, two ips, two flags, write address, count and value
+    constexpr size_t max_record_size = 1 + 1 + 2 + 2 + 2 + 2 + 2 + 2 + 4 + 1 + 2;
+
+    if (writer.buffer.size() + max_record_size > trace_buffer_size)
+        flush(writer);
+
+    const auto jump = static_cast<int16_t>(step.new_ip - step.old_ip);
+
+    trace_fields fields = trace_fields::none;
+    if (step.destination.count != 0 || step.old_value != 0 || step.new_value != 0)
+        fields |= trace_fields::destination;
+    if (step.new_value != step.old_value)
+        fields |= trace_fields::new_value;
+    if (step.old_ip != writer.previous.new_ip)
+        fields |= trace_fields::old_ip;
+    if (jump < INT8_MIN || jump > INT8_MAX)
+        fields |= trace_fields::long_jump;
+    if (step.old_flags != writer.previous.new_flags)
+        fields |= trace_fields::old_flags;
+    if (step.new_flags != step.old_flags)
+        fields |= trace_fields::new_flags;
+    if (step.write.count != 0)
+        fields |= trace_fields::write;
+
+    std::vector<uint8_t>& buffer = writer.buffer;
+    buffer.push_back(static_cast<uint8_t>(fields));
+
+    if (has_any_flag(fields, trace_fields::destination))
+    {
+        buffer.push_back(pack_register(step.destination));
+        append(buffer, step.old_value, 2);
+    }
+
+    if (has_any_flag(fields, trace_fields::new_value))
+        append(buffer, step.new_value, 2);
+
+    if (has_any_flag(fields, trace_fields::old_ip))
+        append(buffer, step.old_ip, 2);
+
+    if (has_any_flag(fields, trace_fields::long_jump))
+        append(buffer, step.new_ip, 2);
+    else
+        buffer.push_back(static_cast<uint8_t>(jump));
+
+    if (has_any_flag(fields, trace_fields::old_flags))
+        append(buffer, static_cast<uint16_t>(step.old_flags), 2);
+
+    if (has_any_flag(fields, trace_fields::new_flags))
+        append(buffer, static_cast<uint16_t>(step.new_flags), 2);
+
+    if (has_any_flag(fields, trace_fields::write))
+    {
+        append(buffer, step.write.address, 4);
+        append(buffer, step.write.count, 1);
+        append(buffer, step.write.value, std::min(static_cast<int>(step.write.count), 2));
+    }
+
+    writer.previous = step;
+}
+
+void close_trace_writer(trace_writer& writer)
+{
+    flush(writer);
+    writer.stream.close();
+}
+
+trace_reader open_trace_reader(const char* path)
+{
+    std::ifstream input_stream{ path, std::ios::binary };
+
+    if (!input_stream)
+        throw std::runtime_error{ "Cannot open trace file." };
+
+    trace_reader reader{ .data = std::vector<uint8_t>(static_cast<size_t>(std::filesystem::file_size(path))) };
+    input_stream.read(reinterpret_cast<char*>(reader.data.data()), static_cast<std::streamsize>(reader.data.size()));
+
+    if (input_stream.gcount() != static_cast<std::streamsize>(reader.data.size()))
+        throw std::runtime_error{ "Cannot read trace file." };
+
+    if (read(reader, 4) != trace_magic || read(reader, 4) != trace_version)
+        throw std::runtime_error{ "Unrecognized trace file format." };
+
+    return reader;
+}
+
+bool read_trace_step(trace_reader& reader, simulation_step& step)
+{
+    if (reader.position == reader.data.size())
+        return false;
+
+    const auto fields = trace_fields{ static_cast<uint8_t>(read(reader, 1)) };
+
+    step = simulation_step{};
+
+    if (has_any_flag(fields, trace_fields::destination))
+    {
+        step.destination = unpack_register(static_cast<uint8_t>(read(reader, 1)));
+        step.old_value = static_cast<uint16_t>(read(reader, 2));
+    }
+
+    step.new_value = has_any_flag(fields, trace_fields::new_value) ? static_cast<uint16_t>(read(reader, 2)) : step.old_value;
+    step.old_ip = has_any_flag(fields, trace_fields::old_ip) ? static_cast<uint16_t>(read(reader, 2)) : reader.previous.new_ip;
+
+    if (has_any_flag(fields, trace_fields::long_jump))
+        step.new_ip = static_cast<uint16_t>(read(reader, 2));
+    else
+        step.new_ip = static_cast<uint16_t>(step.old_ip + static_cast<int8_t>(read(reader, 1)));
+
+    step.old_flags = has_any_flag(fields, trace_fields::old_flags) ? control_flags{ static_cast<uint16_t>(read(reader, 2)) } : reader.previous.new_flags;
+    step.new_flags = has_any_flag(fields, trace_fields::new_flags) ? control_flags{ static_cast<uint16_t>(read(reader, 2)) } : step.old_flags;
+
+    if (has_any_flag(fields, trace_fields::write))
+    {
+        step.write.address = read(reader, 4);
+        step.write.count = read(reader, 1);
+        step.write.value = static_cast<uint16_t>(read(reader, std::min(static_cast<int>(step.write.count), 2)));
+    }
+
+    reader.previous = step;
+    return true;
+}
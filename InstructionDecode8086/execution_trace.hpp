@@ -0,0 +1,37 @@
+﻿#ifndef WS_EXECUTIONTRACE_HPP
+#define WS_EXECUTIONTRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "simulator.hpp"
+
+// streams simulation steps to a binary file, each encoded as the difference from the step before it
+struct trace_writer
+{
+    std::ofstream stream;
+    std::vector<uint8_t> buffer;
+    simulation_step previous{};
+};
+
+struct trace_reader
+{
+    std::vector<uint8_t> data;
+    size_t position{};
+    simulation_step previous{};
+};
+
+trace_writer open_trace_writer(const char* path);
+
+void write_trace_step(trace_writer& writer, const simulation_step& step);
+
+void close_trace_writer(trace_writer& writer);
+
+trace_reader open_trace_reader(const char* path);
+
+// returns false once every step has been read
+bool read_trace_step(trace_reader& reader, simulation_step& step);
+
+#endif
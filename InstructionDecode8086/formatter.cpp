@@ -0,0 +1,179 @@
+﻿#include "formatter.hpp"
+
+#include <algorithm>
+#include <format>
+#include <string_view>
+#include <variant>
+
+#include "cycle_estimator.hpp"
+#include "decoder.hpp"
+#include "instruction.hpp"
+#include "overloaded.hpp"
+#include "simulator.hpp"
+#include "zone_profiler.hpp"
+
+namespace
+{
+    char* append(char* out, std::string_view text)
+    {
+        return std::ranges::copy(text, out).out;
+    }
+
+    std::string_view get_width_name(const instruction& inst)
+    {
+        return has_any_flag(inst.flags, instruction_flags::wide) ? "word" : "byte";
+    }
+
+    char* format_operand(char* out, const instruction& inst, const instruction_operand& operand)
+    {
+        auto matcher = overloaded
+        {
+            [&inst, out](const effective_address_expression& address_op)
+            {
+                char* end = append(out, get_width_name(inst));
+                end = append(end, " [");
+                end = append(end, get_register_name(address_op.term1.reg));
+
+                if (address_op.term2.has_value())
+                {
+                    end = append(end, " + ");
+                    end = append(end, get_register_name(address_op.term2->reg));
+                }
+
+                if (address_op.displacement > 0)
+                    end = std::format_to(end, " + {}", address_op.displacement);
+                else if (address_op.displacement < 0)
+                    end = std::format_to(end, " - {}", -address_op.displacement);
+
+                return append(end, "]");
+            },
+            [&inst, out](direct_address direct_address_op)
+            {
+                return std::format_to(out, "{} [{}]", get_width_name(inst), direct_address_op.address);
+            },
+            [out](register_access register_op)
+            {
+                return append(out, get_register_name(register_op));
+            },
+            [&inst, out](immediate immediate_op)
+            {
+                if (has_any_flag(immediate_op.flags, immediate_flags::relative_jump_displacement))
+                {
+                    const int32_t value = immediate_op.value + static_cast<int32_t>(inst.size);
+                    return std::format_to(out, "${:+}", value);
+                }
+
+                if (has_any_flag(inst.flags, instruction_flags::wide))
+                    return std::format_to(out, "{}", static_cast<uint16_t>(immediate_op.value));
+                else
+                    return std::format_to(out, "{}", static_cast<uint8_t>(immediate_op.value));
+            },
+            [out](std::monostate) { return out; }
+        };
+
+        return std::visit(matcher, operand);
+    }
+
+    char* format_state_transition(char* out, const char* destination_register, size_t width, uint16_t old_value, uint16_t new_value)
+    {
+        char* end = std::format_to(out, "{}:{:#x}->{:#x}", destination_register, old_value, new_value);
+        return pad_column(out, end, width);
+    }
+
+    char* format_flags_transition(char* out, const char* flag_register, size_t width, const simulation_step& step)
+    {
+        char* end = std::format_to(out, "{}:{}->{}", flag_register, get_flag_text(step.old_flags), get_flag_text(step.new_flags));
+        return pad_column(out, end, width);
+    }
+}
+
+char* format_instruction(char* out, const instruction& inst)
+{
+    PROFILE_FUNCTION();
+
+    char* end = append(out, get_mneumonic(inst.op));
+
+    // operands are written after a separator, which is dropped again if the operand turns out to be empty
+    char* first_operand = append(end, " ");
+    char* first_operand_end = format_operand(first_operand, inst, inst.operands[0]);
+    if (first_operand_end != first_operand)
+        end = first_operand_end;
+
+    char* second_operand = append(end, ", ");
+    char* second_operand_end = format_operand(second_operand, inst, inst.operands[1]);
+    if (second_operand_end != second_operand)
+        end = second_operand_end;
+
+    return end;
+}
+
+char* format_simulation_step(char* out, const simulation_step& step)
+{
+    PROFILE_FUNCTION();
+
+    constexpr size_t column_width = 20;
+    char* end = out;
+
+    if (step.new_value != step.old_value)
+    {
+        const char* destination_register = get_register_name(step.destination);
+        end = format_state_transition(end, destination_register, column_width, step.old_value, step.new_value);
+    }
+    else
+    {
+        end = pad_column(end, end, column_width);
+    }
+
+    const auto ip_name = get_register_name({ .index = instruction_pointer_index, .offset = 0, .count = 2 });
+    end = format_state_transition(end, ip_name, column_width, step.old_ip, step.new_ip);
+
+    if (step.new_flags != step.old_flags)
+    {
+        const auto flags_name = get_register_name({ .index = flags_index, .offset = 0, .count = 2 });
+        end = format_flags_transition(end, flags_name, 10, step);
+    }
+
+    return end;
+}
+
+char* format_cycle_estimate(char* out, int32_t current_cycles, int32_t base, int32_t ea, int32_t penalty, int32_t stall, int64_t total_cycles)
+{
+    char* end = std::format_to(out, "Clocks: {:+} = {}", current_cycles, total_cycles);
+    if (ea != 0 || penalty != 0 || stall != 0)
+    {
+        end = std::format_to(end, " ({}", base);
+
+        if (ea != 0)
+            end = std::format_to(end, " + {}ea", ea);
+        if (penalty != 0)
+            end = std::format_to(end, " + {}p", penalty);
+        if (stall != 0)
+            end = std::format_to(end, " + {}stall", stall);
+
+        *end++ = ')';
+    }
+
+    constexpr size_t column_width = 28;
+    return pad_column(out, end, column_width);
+}
+
+char* format_cycle_interval(char* out, const cycle_interval& base, int32_t ea)
+{
+    char* end = std::format_to(out, "Clocks: {}", base.min + ea);
+    if (base.max != base.min)
+        end = std::format_to(end, "..{}", base.max + ea);
+
+    if (ea != 0)
+        end = std::format_to(end, " ({} + {}ea)", base.min, ea);
+
+    return end;
+}
+
+char* pad_column(const char* column_start, char* out, size_t width)
+{
+    const auto length = static_cast<size_t>(out - column_start);
+    if (length >= width)
+        return out;
+
+    return std::fill_n(out, width - length, ' ');
+}
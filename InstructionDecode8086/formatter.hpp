@@ -0,0 +1,29 @@
+﻿#ifndef WS_FORMATTER_HPP
+#define WS_FORMATTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+struct cycle_interval;
+struct instruction;
+struct simulation_step;
+
+// large enough for one full line of disassembly, cycle estimate and simulation step
+inline constexpr size_t line_buffer_size = 256;
+
+// each function appends text at out and returns the new end of the text, without allocating
+
+char* format_instruction(char* out, const instruction& inst);
+
+char* format_simulation_step(char* out, const simulation_step& step);
+
+// the parts after base are only shown when they are not zero
+char* format_cycle_estimate(char* out, int32_t current_cycles, int32_t base, int32_t ea, int32_t penalty, int32_t stall, int64_t total_cycles);
+
+// the possible cost of an instruction that has not run, as a range when it depends on a branch
+char* format_cycle_interval(char* out, const cycle_interval& base, int32_t ea);
+
+// pads the text starting at column_start with spaces until it is at least width characters long
+char* pad_column(const char* column_start, char* out, size_t width);
+
+#endif
@@ -0,0 +1,385 @@
+﻿#include "lockstep.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <variant>
+
+#include "decoder.hpp"
+#include "instruction.hpp"
+
+namespace
+{
+    using lane_mask = uint32_t;
+    using lane_values = std::array<uint16_t, lockstep_lane_count>;
+
+    // registers[register][lane]
+    using lockstep_registers = std::array<lane_values, register_count>;
+
+    // steps in a row that may run only part of the lanes before the rest are left to finish on their own
+    constexpr uint32_t max_divergent_steps = 64;
+
+    constexpr uint16_t carry_bit = static_cast<uint16_t>(control_flags::carry);
+    constexpr uint16_t parity_bit = static_cast<uint16_t>(control_flags::parity);
+    constexpr uint16_t aux_carry_bit = static_cast<uint16_t>(control_flags::aux_carry);
+    constexpr uint16_t zero_bit = static_cast<uint16_t>(control_flags::zero);
+    constexpr uint16_t sign_bit = static_cast<uint16_t>(control_flags::sign);
+    constexpr uint16_t overflow_bit = static_cast<uint16_t>(control_flags::overflow);
+
+    uint16_t blend(uint16_t select, uint16_t selected, uint16_t other)
+    {
+        return (selected & select) | (other & ~select);
+    }
+
+    // the same flags compute_flags in the simulator produces for a word operation
+    uint16_t compute_word_flags(int32_t existing, int32_t operand, int32_t result, bool is_addition)
+    {
+        uint32_t parity = static_cast<uint32_t>(result) & 0xFF;
+        parity ^= parity >> 4;
+        parity ^= parity >> 2;
+        parity ^= parity >> 1;
+
+        const int32_t existing_unsigned = existing & 0xFFFF;
+        const int32_t operand_unsigned = operand & 0xFFFF;
+        const int32_t result_unsigned = is_addition ? existing_unsigned + operand_unsigned : existing_unsigned - operand_unsigned;
+
+        const int32_t existing_nibble = existing & 0xF;
+        const int32_t operand_nibble = operand & 0xF;
+        const int32_t result_nibble = is_addition ? existing_nibble + operand_nibble : existing_nibble - operand_nibble;
+
+        uint16_t flags = 0;
+        flags |= (parity & 1) == 0 ? parity_bit : 0;
+        flags |= result == 0 ? zero_bit : 0;
+        flags |= (result & 0x8000) != 0 ? sign_bit : 0;
+        flags |= (result > INT16_MAX || result < INT16_MIN) ? overflow_bit : 0;
+        flags |= (result_unsigned > UINT16_MAX || result_unsigned < 0) ? carry_bit : 0;
+        flags |= (result_nibble > 0xF || result_nibble < 0) ? aux_carry_bit : 0;
+
+        return flags;
+    }
+
+    void advance_ip(lockstep_registers& registers, const lane_values& select, uint16_t size)
+    {
+        lane_values& ip = registers[instruction_pointer_index];
+
+        for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+            ip[lane] = blend(select[lane], static_cast<uint16_t>(ip[lane] + size), ip[lane]);
+    }
+
+    // mov, add, sub or cmp of a word register with a word register or an immediate
+    bool execute_arithmetic(const instruction& inst, lockstep_registers& registers, const lane_values& select)
+    {
+        const auto* destination = std::get_if<register_access>(&inst.operands[0]);
+        if (destination == nullptr || destination->count != 2)
+            return false;
+
+        lane_values source{};
+
+        if (const auto* source_register = std::get_if<register_access>(&inst.operands[1]); source_register != nullptr && source_register->count == 2)
+            source = registers[source_register->index];
+        else if (const auto* source_immediate = std::get_if<immediate>(&inst.operands[1]))
+            source.fill(static_cast<uint16_t>(source_immediate->value));
+        else
+            return false;
+
+        lane_values& values = registers[destination->index];
+        lane_values& flags = registers[flags_index];
+
+        if (inst.op == operation_type::mov)
+        {
+            for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+                values[lane] = blend(select[lane], source[lane], values[lane]);
+        }
+        else
+        {
+            const bool is_addition = (inst.op == operation_type::add);
+            const bool writes_result = (inst.op != operation_type::cmp);
+
+            for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+            {
+                const int32_t existing = static_cast<int16_t>(values[lane]);
+                const int32_t operand = static_cast<int16_t>(source[lane]);
+                const int32_t result = is_addition ? existing + operand : existing - operand;
+
+                const uint16_t result_select = writes_result ? select[lane] : 0;
+                values[lane] = blend(result_select, static_cast<uint16_t>(result), values[lane]);
+                flags[lane] = blend(select[lane], compute_word_flags(existing, operand, result, is_addition), flags[lane]);
+            }
+        }
+
+        advance_ip(registers, select, static_cast<uint16_t>(inst.size));
+        return true;
+    }
+
+    // condition takes each lane's flags and cx (after any decrement) and returns whether that lane jumps
+    template <typename Condition>
+    void execute_jump(const instruction& inst, lockstep_registers& registers, const lane_values& select, bool decrements_counter, Condition condition)
+    {
+        const auto displacement = static_cast<uint16_t>(std::get<immediate>(inst.operands[0]).value);
+        const auto size = static_cast<uint16_t>(inst.size);
+
+        lane_values& ip = registers[instruction_pointer_index];
+        lane_values& counter = registers[counter_register_index];
+        const lane_values& flags = registers[flags_index];
+
+        for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+        {
+            const uint16_t new_counter = decrements_counter ? static_cast<uint16_t>(counter[lane] - 1) : counter[lane];
+            counter[lane] = blend(select[lane], new_counter, counter[lane]);
+
+            const uint16_t taken = condition(flags[lane], new_counter) ? 0xFFFF : 0;
+            const auto next_ip = static_cast<uint16_t>(ip[lane] + size + (displacement & taken));
+            ip[lane] = blend(select[lane], next_ip, ip[lane]);
+        }
+    }
+
+    bool execute_branch(const instruction& inst, lockstep_registers& registers, const lane_values& select)
+    {
+        if (!std::holds_alternative<immediate>(inst.operands[0]))
+            return false;
+
+        const auto is_set = [](uint16_t flags, uint16_t bits) { return (flags & bits) != 0; };
+        const auto less = [](uint16_t flags) { return ((flags & sign_bit) != 0) != ((flags & overflow_bit) != 0); };
+
+        switch (inst.op)
+        {
+            case operation_type::je: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return is_set(f, zero_bit); }); break;
+            case operation_type::jne: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !is_set(f, zero_bit); }); break;
+            case operation_type::jl: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return less(f); }); break;
+            case operation_type::jnl: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !less(f); }); break;
+            case operation_type::jle: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return less(f) || is_set(f, zero_bit); }); break;
+            case operation_type::jg: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !less(f) || !is_set(f, zero_bit); }); break;
+            case operation_type::jb: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return is_set(f, carry_bit); }); break;
+            case operation_type::jnb: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !is_set(f, carry_bit); }); break;
+            case operation_type::jbe: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return is_set(f, zero_bit | carry_bit); }); break;
+            case operation_type::ja: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !is_set(f, zero_bit | carry_bit); }); break;
+            case operation_type::jp: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return is_set(f, parity_bit); }); break;
+            case operation_type::jnp: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !is_set(f, parity_bit); }); break;
+            case operation_type::jo: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return is_set(f, overflow_bit); }); break;
+            case operation_type::jno: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !is_set(f, overflow_bit); }); break;
+            case operation_type::js: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return is_set(f, sign_bit); }); break;
+            case operation_type::jns: execute_jump(inst, registers, select, false, [&](uint16_t f, uint16_t) { return !is_set(f, sign_bit); }); break;
+            case operation_type::loop: execute_jump(inst, registers, select, true, [](uint16_t, uint16_t cx) { return cx != 0; }); break;
+            case operation_type::loopz: execute_jump(inst, registers, select, true, [&](uint16_t f, uint16_t cx) { return cx == 0 && is_set(f, zero_bit); }); break;
+            case operation_type::loopnz: execute_jump(inst, registers, select, true, [&](uint16_t f, uint16_t cx) { return cx != 0 && !is_set(f, zero_bit); }); break;
+            case operation_type::jcxz: execute_jump(inst, registers, select, false, [](uint16_t, uint16_t cx) { return cx == 0; }); break;
+            case operation_type::jmp: execute_jump(inst, registers, select, false, [](uint16_t, uint16_t) { return true; }); break;
+
+            default:
+                return false;
+        }
+
+        return true;
+    }
+
+    bool execute_lanes(const instruction& inst, lockstep_registers& registers, const lane_values& select)
+    {
+        switch (inst.op)
+        {
+            case operation_type::mov:
+            case operation_type::add:
+            case operation_type::sub:
+            case operation_type::cmp:
+                return execute_arithmetic(inst, registers, select);
+
+            default:
+                return execute_branch(inst, registers, select);
+        }
+    }
+
+    register_array get_lane_registers(const lockstep_registers& registers, size_t lane)
+    {
+        register_array lane_registers{};
+
+        for (size_t i = 0; i < lane_registers.size(); ++i)
+            lane_registers[i] = registers[i][lane];
+
+        return lane_registers;
+    }
+
+    void set_lane_registers(lockstep_registers& registers, size_t lane, const register_array& lane_registers)
+    {
+        for (size_t i = 0; i < lane_registers.size(); ++i)
+            registers[i][lane] = lane_registers[i];
+    }
+}
+
+std::vector<lockstep_outcome> run_lockstep(std::span<machine> lanes, const run_limits& limits)
+{
+    if (lanes.size() > lockstep_lane_count)
+        throw std::runtime_error{ "Too many machines for one lockstep group." };
+
+    std::vector<lockstep_outcome> outcomes(lanes.size());
+
+    if (lanes.empty())
+        return outcomes;
+
+    lockstep_registers registers{};
+    for (size_t lane = 0; lane < lanes.size(); ++lane)
+        set_lane_registers(registers, lane, lanes[lane].registers);
+
+    // every lane runs the same code, so each instruction is decoded once, from a copy that lanes writing to their own
+    // code cannot change
+    const uint32_t code_begin = lanes[0].cache.code_begin;
+    const uint32_t code_end = lanes[0].cache.code_end;
+
+    std::vector<uint8_t> code(lanes[0].memory->begin() + code_begin, lanes[0].memory->begin() + code_end);
+    std::vector<std::optional<instruction>> decoded(code.size());
+
+    // bookkeeping is kept per lane as well, so each step only checks the lanes one by one when something changes
+    lane_values running{};
+    std::array<uint64_t, lockstep_lane_count> counts{};
+
+    for (size_t lane = 0; lane < lanes.size(); ++lane)
+    {
+        running[lane] = 0xFFFF;
+        counts[lane] = lanes[lane].instruction_count;
+    }
+
+    lane_mask detached = 0;
+
+    // cycle estimates are made one instruction at a time, so every lane runs on its own
+    if (limits.estimate_clocks)
+    {
+        running.fill(0);
+        detached = (lane_mask{ 1 } << lanes.size()) - 1;
+    }
+
+    const lane_values& ips = registers[instruction_pointer_index];
+    const uint32_t code_size = code_end - code_begin;
+    uint32_t divergent_steps = 0;
+
+    while (true)
+    {
+        // retire lanes that ran out of code or budget
+        uint16_t retiring = 0;
+        for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+            retiring |= running[lane] & ((ips[lane] >= code_size || counts[lane] >= limits.max_instructions) ? 0xFFFF : 0);
+
+        if (retiring != 0)
+        {
+            for (size_t lane = 0; lane < lanes.size(); ++lane)
+            {
+                if (running[lane] == 0)
+                    continue;
+
+                if (ips[lane] >= code_size)
+                    outcomes[lane].stop = stop_reason::finished;
+                else if (counts[lane] >= limits.max_instructions)
+                    outcomes[lane].stop = stop_reason::instruction_budget;
+                else
+                    continue;
+
+                running[lane] = 0;
+            }
+        }
+
+        // the lowest ip goes first, so lanes that fell behind catch up with the others
+        uint16_t any_running = 0;
+        uint16_t ip = UINT16_MAX;
+
+        for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+        {
+            any_running |= running[lane];
+            ip = std::min(ip, blend(running[lane], ips[lane], UINT16_MAX));
+        }
+
+        if (any_running == 0)
+            break;
+
+        lane_values select{};
+        uint16_t divergent = 0;
+
+        for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+        {
+            select[lane] = running[lane] & (ips[lane] == ip ? 0xFFFF : 0);
+            divergent |= running[lane] ^ select[lane];
+        }
+
+        if (divergent == 0)
+        {
+            divergent_steps = 0;
+        }
+        else if (++divergent_steps > max_divergent_steps)
+        {
+            for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+            {
+                if (running[lane] != 0)
+                    detached |= lane_mask{ 1 } << lane;
+            }
+
+            break;
+        }
+
+        std::optional<instruction>& decoded_inst = decoded[ip];
+        if (!decoded_inst.has_value())
+        {
+            auto data_iter = std::span{ code }.begin() + ip;
+            decoded_inst = decode_instruction(data_iter, std::span{ code }.end(), code_begin + ip);
+        }
+
+        const instruction& inst = *decoded_inst;
+
+        if (!execute_lanes(inst, registers, select))
+        {
+            // anything else runs one lane at a time with the scalar simulator and that lane's memory
+            for (size_t lane = 0; lane < lanes.size(); ++lane)
+            {
+                if (select[lane] == 0)
+                    continue;
+
+                machine& sim = lanes[lane];
+                register_array lane_registers = get_lane_registers(registers, lane);
+
+                try
+                {
+                    const simulation_step step = simulate_instruction(inst, lane_registers, *sim.memory);
+                    invalidate_instructions(sim.cache, step.write);
+
+                    if (step.write.count != 0 && step.write.address < code_end && step.write.address + step.write.count > code_begin)
+                    {
+                        detached |= lane_mask{ 1 } << lane;
+                        running[lane] = 0;
+                    }
+                }
+                catch (std::exception& ex)
+                {
+                    outcomes[lane].error = ex.what();
+                    running[lane] = 0;
+                    select[lane] = 0;
+                }
+
+                set_lane_registers(registers, lane, lane_registers);
+            }
+        }
+
+        for (size_t lane = 0; lane < lockstep_lane_count; ++lane)
+            counts[lane] += select[lane] & 1;
+    }
+
+    for (size_t lane = 0; lane < lanes.size(); ++lane)
+    {
+        lanes[lane].registers = get_lane_registers(registers, lane);
+        lanes[lane].instruction_count = counts[lane];
+    }
+
+    for (lane_mask remaining = detached; remaining != 0; remaining &= remaining - 1)
+    {
+        const auto lane = static_cast<size_t>(std::countr_zero(remaining));
+
+        try
+        {
+            outcomes[lane].stop = run_machine(lanes[lane], limits);
+        }
+        catch (std::exception& ex)
+        {
+            outcomes[lane].error = ex.what();
+        }
+    }
+
+    return outcomes;
+}
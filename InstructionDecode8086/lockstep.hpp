@@ -0,0 +1,24 @@
+﻿#ifndef WS_LOCKSTEP_HPP
+#define WS_LOCKSTEP_HPP
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "machine.hpp"
+
+inline constexpr size_t lockstep_lane_count = 16;
+
+struct lockstep_outcome
+{
+    stop_reason stop{};
+    std::string error;
+};
+
+// runs machines that have the same program loaded side by side, one instruction for all of them at a time, with their
+// registers stored register by register so register-only mov/add/sub/cmp and conditional jumps apply to every lane in
+// one pass; lanes whose paths diverge for too long, or that write to their code, finish on their own
+std::vector<lockstep_outcome> run_lockstep(std::span<machine> lanes, const run_limits& limits);
+
+#endif
@@ -0,0 +1,241 @@
+﻿#include "machine.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "cycle_estimator.hpp"
+#include "execution_trace.hpp"
+#include "instruction.hpp"
+#include "threaded_interpreter.hpp"
+
+namespace
+{
+    constexpr uint32_t segment_size = 64 * 1024;
+
+    uint32_t get_code_address(const machine& sim)
+    {
+        return sim.cache.code_begin + sim.registers[instruction_pointer_index];
+    }
+
+    bool is_same_step(const simulation_step& a, const simulation_step& b)
+    {
+        return a.destination.index == b.destination.index && a.destination.offset == b.destination.offset && a.destination.count == b.destination.count
+            && a.old_value == b.old_value && a.new_value == b.new_value
+            && a.old_flags == b.old_flags && a.new_flags == b.new_flags
+            && a.old_ip == b.old_ip && a.new_ip == b.new_ip
+            && a.write.address == b.write.address && a.write.count == b.write.count && a.write.value == b.write.value && a.write.old_value == b.write.old_value
+            && a.memory_address == b.memory_address;
+    }
+}
+
+machine create_machine()
+{
+    return machine
+    {
+        .registers = {},
+        .memory = std::make_unique<memory_array>(),
+        .cache = {},
+        .lazy = {},
+        .instruction_count = 0,
+        .total_cycles = 0
+    };
+}
+
+void reset_machine(machine& sim)
+{
+    sim.registers = {};
+    std::ranges::fill(*sim.memory, uint8_t{ 0 });
+    sim.cache = {};
+    sim.lazy = {};
+    sim.instruction_count = 0;
+    sim.total_cycles = 0;
+    sim.prefetch = {};
+    sim.stall_cycles = 0;
+    sim.profile = {};
+}
+
+std::span<uint8_t> load_program(machine& sim, const std::string& path, uint16_t code_segment)
+{
+    std::ifstream input_file{ path, std::ios::binary };
+
+    if (!input_file)
+        throw std::runtime_error{ "Cannot open binary file." };
+
+    const auto file_size = std::filesystem::file_size(path);
+    const uint32_t code_begin = static_cast<uint32_t>(code_segment) << 4;
+
+    if (file_size > segment_size || code_begin + file_size > memory_size)
+        throw std::runtime_error{ "Instructions must fit within a single memory segment." };
+
+    const std::span<uint8_t> data = std::span{ *sim.memory }.subspan(code_begin, static_cast<size_t>(file_size));
+    input_file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+    if (input_file.gcount() != static_cast<std::streamsize>(data.size()))
+        throw std::runtime_error{ "Cannot read binary file." };
+
+    sim.registers[code_segment_index] = code_segment;
+    sim.cache = create_decode_cache(code_begin, static_cast<uint32_t>(data.size()));
+
+    return data;
+}
+
+std::span<uint8_t> place_program(machine& sim, std::span<const uint8_t> program, uint16_t code_segment)
+{
+    const uint32_t code_begin = static_cast<uint32_t>(code_segment) << 4;
+
+    if (program.size() > segment_size || code_begin + program.size() > memory_size)
+        throw std::runtime_error{ "Instructions must fit within a single memory segment." };
+
+    const std::span<uint8_t> data = std::span{ *sim.memory }.subspan(code_begin, program.size());
+    std::ranges::copy(program, data.begin());
+
+    sim.registers[code_segment_index] = code_segment;
+    sim.cache = create_decode_cache(code_begin, static_cast<uint32_t>(data.size()));
+
+    return data;
+}
+
+simulation_step step_machine(machine& sim)
+{
+    // flags left pending by run_machine must be current before an eager step
+    materialize_flags(sim.lazy, sim.registers);
+
+    const instruction& inst = fetch_instruction(sim.cache, *sim.memory, get_code_address(sim));
+    const simulation_step step = simulate_instruction(inst, sim.registers, *sim.memory);
+
+    // self-modifying code must be decoded again
+    invalidate_instructions(sim.cache, step.write);
+    ++sim.instruction_count;
+
+    return step;
+}
+
+step_timing charge_step_cycles(machine& sim, const run_limits& limits, const simulation_step& step, const instruction& inst)
+{
+    // timing was worked out when the instruction was decoded, and the step says which way a branch went
+    const cycle_annotation& annotation = get_cycle_annotation(sim.cache, sim.cache.code_begin + step.old_ip);
+
+    // taken branches are told apart by where the step left ip, and split word transfers are charged at the address the step actually used
+    const bool taken = is_jump_taken(step, inst.size);
+    const int32_t cycles = taken ? annotation.cycles.max : annotation.cycles.min;
+    const bool wide = has_any_flag(inst.flags, instruction_flags::wide);
+
+    step_timing timing{ .ea = annotation.estimate.ea };
+    timing.base = cycles - timing.ea;
+    timing.penalty = annotation.estimate.transfers == 0 ? 0 : get_transfer_penalty(annotation.estimate, limits.model, wide, step.memory_address);
+    timing.cycles = cycles + timing.penalty;
+
+    if (limits.model_prefetch)
+    {
+        // the queue starts out empty, sized for the model being timed
+        if (sim.prefetch.capacity == 0)
+            sim.prefetch = create_prefetch_queue(limits.model);
+
+        timing.stall = consume_prefetch(sim.prefetch, inst.size, timing.cycles, annotation.estimate.transfers, taken);
+        sim.stall_cycles += timing.stall;
+    }
+
+    sim.total_cycles += timing.cycles + timing.stall;
+
+    if (!sim.profile.addresses.empty())
+        record_profile_step(sim.profile, step.old_ip, timing.cycles + timing.stall);
+
+    return timing;
+}
+
+stop_reason run_machine(machine& sim, const run_limits& limits, trace_writer* trace)
+{
+    while (get_code_address(sim) < sim.cache.code_end)
+    {
+        if (sim.instruction_count >= limits.max_instructions)
+            return stop_reason::instruction_budget;
+
+        if (static_cast<uint64_t>(sim.total_cycles) >= limits.max_cycles)
+            return stop_reason::cycle_budget;
+
+        const uint32_t address = get_code_address(sim);
+        simulation_step step{};
+        const instruction* inst = nullptr;
+        uint32_t instruction_count = 1;
+
+        if (limits.engine != execution_engine::reference)
+        {
+            // a pair only reports one step, so fusing is off whenever steps are traced or timed, or the budget ends between the two
+            const bool fuse = limits.engine == execution_engine::fused && !trace && !limits.estimate_clocks
+                && limits.max_instructions - sim.instruction_count >= 2;
+
+            const threaded_op& op = fuse ? fetch_fused_op(sim.cache, *sim.memory, address) : fetch_threaded_op(sim.cache, *sim.memory, address);
+            threaded_context context{ sim.registers, *sim.memory, sim.lazy, sim.cache };
+            step = execute_threaded(op, context);
+            instruction_count = op.instruction_count;
+
+            // a traced step needs its flags, which simulate_instruction would have computed eagerly
+            if (trace)
+                step.new_flags = materialize_flags(sim.lazy, sim.registers);
+
+            // the whole instruction is only needed for its timing
+            if (limits.estimate_clocks)
+                inst = &sim.cache.instructions[op.entry_index];
+        }
+        else
+        {
+            inst = &fetch_instruction(sim.cache, *sim.memory, address);
+
+            // flags are only computed when something reads them, unless every step is traced
+            step = trace
+                ? simulate_instruction(*inst, sim.registers, *sim.memory)
+                : simulate_instruction(*inst, sim.registers, *sim.memory, sim.lazy);
+        }
+
+        if (trace)
+            write_trace_step(*trace, step);
+
+        invalidate_instructions(sim.cache, step.write);
+
+        if (limits.estimate_clocks)
+            charge_step_cycles(sim, limits, step, *inst);
+
+        sim.instruction_count += instruction_count;
+    }
+
+    return stop_reason::finished;
+}
+
+engine_divergence compare_engines(machine& reference_sim, machine& threaded_sim, uint64_t max_instructions)
+{
+    while (get_code_address(reference_sim) < reference_sim.cache.code_end && reference_sim.instruction_count < max_instructions)
+    {
+        const uint16_t ip = reference_sim.registers[instruction_pointer_index];
+
+        const instruction& inst = fetch_instruction(reference_sim.cache, *reference_sim.memory, get_code_address(reference_sim));
+        simulation_step reference_step = simulate_instruction(inst, reference_sim.registers, *reference_sim.memory, reference_sim.lazy);
+        reference_step.new_flags = materialize_flags(reference_sim.lazy, reference_sim.registers);
+
+        const threaded_op& op = fetch_threaded_op(threaded_sim.cache, *threaded_sim.memory, get_code_address(threaded_sim));
+        threaded_context context{ threaded_sim.registers, *threaded_sim.memory, threaded_sim.lazy, threaded_sim.cache };
+        simulation_step threaded_step = execute_threaded(op, context);
+        threaded_step.new_flags = materialize_flags(threaded_sim.lazy, threaded_sim.registers);
+
+        invalidate_instructions(reference_sim.cache, reference_step.write);
+        invalidate_instructions(threaded_sim.cache, threaded_step.write);
+
+        if (!is_same_step(reference_step, threaded_step) || reference_sim.registers != threaded_sim.registers)
+        {
+            return engine_divergence
+            {
+                .found = true,
+                .instruction_index = reference_sim.instruction_count,
+                .ip = ip,
+                .reference_step = reference_step,
+                .threaded_step = threaded_step
+            };
+        }
+
+        ++reference_sim.instruction_count;
+        ++threaded_sim.instruction_count;
+    }
+
+    return {};
+}
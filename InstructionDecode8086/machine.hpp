@@ -0,0 +1,102 @@
+﻿#ifndef WS_MACHINE_HPP
+#define WS_MACHINE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+#include "cycle_estimator.hpp"
+#include "decode_cache.hpp"
+#include "execution_profile.hpp"
+#include "prefetch_queue.hpp"
+#include "simulator.hpp"
+
+struct trace_writer;
+
+inline constexpr uint64_t no_budget = UINT64_MAX;
+
+enum class stop_reason
+{
+    finished,
+    instruction_budget,
+    cycle_budget
+};
+
+// simulate_instruction stays the reference that the threaded engine is checked against
+enum class execution_engine : uint8_t
+{
+    reference,
+    threaded,
+    fused // threaded, running flag-setting instructions and the branches after them as pairs when nothing needs each step
+};
+
+struct run_limits
+{
+    uint64_t max_instructions = no_budget;
+    uint64_t max_cycles = no_budget;
+    bool estimate_clocks{};
+    cpu_model model = cpu_model::i8086;
+    bool model_prefetch{}; // adds the clocks spent waiting on the prefetch queue to the estimates
+    execution_engine engine = execution_engine::reference;
+};
+
+// clocks charged for one executed instruction, kept in parts for display
+struct step_timing
+{
+    int32_t cycles{}; // base + ea + penalty, everything but the stall
+    int32_t base{};
+    int32_t ea{};
+    int32_t penalty{}; // odd-address word transfers
+    int32_t stall{};
+};
+
+// the whole state of one simulation, so any number of them can run side by side
+struct machine
+{
+    register_array registers{};
+    std::unique_ptr<memory_array> memory;
+    decode_cache cache{};
+    lazy_flags lazy{};
+    uint64_t instruction_count{};
+    int64_t total_cycles{};
+    prefetch_queue prefetch{};
+    int64_t stall_cycles{};
+    execution_profile profile{}; // only filled in when it has been sized for the loaded code
+};
+
+machine create_machine();
+
+// clears registers, memory and counters so the machine can run another program
+void reset_machine(machine& sim);
+
+// reads a program into the given code segment with a single bulk read and prepares it for execution, returning the loaded bytes
+std::span<uint8_t> load_program(machine& sim, const std::string& path, uint16_t code_segment);
+
+// copies a program already in host memory into the given code segment, e.g. to run it again after reset_machine
+std::span<uint8_t> place_program(machine& sim, std::span<const uint8_t> program, uint16_t code_segment);
+
+// executes the instruction at cs:ip, computing flags eagerly so the step is complete
+simulation_step step_machine(machine& sim);
+
+// adds an executed instruction's clocks to the machine's totals, with prefetch stalls when the limits model them,
+// and to the profile when there is one
+step_timing charge_step_cycles(machine& sim, const run_limits& limits, const simulation_step& step, const instruction& inst);
+
+// executes until the program ends or a budget runs out, without any per-step output
+stop_reason run_machine(machine& sim, const run_limits& limits, trace_writer* trace = nullptr);
+
+// where two machines running the same program stopped agreeing, if they did
+struct engine_divergence
+{
+    bool found{};
+    uint64_t instruction_index{};
+    uint16_t ip{};
+    simulation_step reference_step{};
+    simulation_step threaded_step{};
+};
+
+// steps both machines in turn, one per engine, comparing every step, the registers after it and the memory it wrote
+engine_divergence compare_engines(machine& reference_sim, machine& threaded_sim, uint64_t max_instructions);
+
+#endif
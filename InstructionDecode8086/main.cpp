@@ -1,33 +1,50 @@
 #include <algorithm>
 #include <array>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <filesystem>
 #include <format>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
-#include <iterator>
+#include <optional>
 #include <ranges>
 #include <span>
 #include <sstream>
+#include <stdexcept>
 #include <string>
-#include <unordered_set>
-#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 
+#include "batch_runner.hpp"
+#include "control_flow.hpp"
 #include "cycle_estimator.hpp"
+#include "decode_cache.hpp"
+#include "execution_profile.hpp"
+#include "execution_trace.hpp"
 #include "flag_utils.hpp"
 #include "decoder.hpp"
-#include "overloaded.hpp"
+#include "formatter.hpp"
 #include "instruction.hpp"
+#include "machine.hpp"
+#include "memory_dump.hpp"
+#include "platform_metrics.hpp"
 #include "simulator.hpp"
+#include "static_recompiler.hpp"
+#include "time_travel.hpp"
+#include "zone_profiler.hpp"
 
 namespace
 {
-    using namespace std::string_literals;
+    using namespace std::string_view_literals;
 
-    memory_array memory = {};
+    constexpr uint64_t default_checkpoint_interval = 100'000;
+
+    constexpr auto dump_filename = "dump.data";
+    constexpr auto delta_filename = "dump.delta";
 
     struct sim86_arguments
     {
@@ -35,199 +52,652 @@ namespace
         bool execute_mode{};
         bool dump_memory{};
         bool show_clocks{};
+        bool benchmark_decoding{};
+        bool show_timing{};
+        bool delta_dump{};
+        bool expand_dump{};
+        bool quiet{};
+        uint64_t max_instructions = no_budget;
+        uint64_t max_cycles = no_budget;
+        std::string trace_path;
+        std::string read_trace_path;
+        bool csv{};
+        bool debug{};
+        bool batch{};
+        bool lockstep{};
+        unsigned thread_count{};
+        uint64_t checkpoint_interval = default_checkpoint_interval;
+        cpu_model model = cpu_model::i8086;
+        bool model_prefetch{};
+        bool profile{};
+        bool control_flow{};
+        std::string dot_path;
+        uint64_t bench_runs{};
+        bool threaded{};
+        bool fused{};
+        bool compare_engines{};
+        std::string recompile_path;
     };
 
-    std::vector<uint8_t> read_binary_file(const std::string& path)
+    // saves what a failed run traced; a failure to save must not hide the original error
+    void close_trace_after_error(std::optional<trace_writer>& trace)
     {
-        std::vector<uint8_t> data;
+        if (!trace)
+            return;
 
-        std::ifstream input_file{ path, std::ios::binary };
+        try
+        {
+            close_trace_writer(*trace);
+        }
+        catch (const std::exception&)
+        {
+        }
 
-        if (!input_file)
-            throw std::exception{ "Cannot open binary file." };
+        trace.reset();
+    }
 
-        std::for_each(std::istreambuf_iterator(input_file),
-            std::istreambuf_iterator<char>(),
-            [&data](char c)
+    // accepts a whole non-negative decimal number
+    bool parse_count(const std::string& text, uint64_t& count)
+    {
+        const char* text_end = text.data() + text.size();
+        const auto [parse_end, error] = std::from_chars(text.data(), text_end, count);
+
+        return !text.empty() && error == std::errc{} && parse_end == text_end;
+    }
+
+    std::string print_register_contents(const register_array& registers)
+    {
+        std::ostringstream builder;
+
+        for (size_t i = 0; i < registers.size(); ++i)
+        {
+            const uint16_t reg_value = registers[i];
+            if (reg_value == 0)
+                continue;
+
+            const auto index = static_cast<register_index>(i);
+            char const* register_name = get_register_name({ .index = index, .offset = 0, .count = 2 });
+
+            if (i == flags_index)
+            {
+                const auto flags = control_flags{ registers[flags_index] };
+                builder << std::vformat("{0: >8}: {1}\n", std::make_format_args(register_name, get_flag_string(flags)));
+            }
+            else
             {
-                data.push_back(c);
-            });
+                builder << std::vformat("{0: >8}: {1:#06x} ({1:d})\n", std::make_format_args(register_name, reg_value));
+            }
+        }
 
-        return data;
+        return builder.str();
     }
 
-    std::string print_width(const instruction& inst)
+    void apply_trace_step(const simulation_step& step, machine& sim)
     {
-        return has_any_flag(inst.flags, instruction_flags::wide) ? "word" : "byte";
+        register_array& registers = sim.registers;
+        memory_array& memory = *sim.memory;
+
+        if (step.destination.count != 0)
+            registers[step.destination.index] = step.new_value;
+
+        registers[instruction_pointer_index] = step.new_ip;
+        registers[flags_index] = static_cast<uint16_t>(step.new_flags);
+
+        if (step.write.count != 0)
+        {
+            memory[step.write.address] = step.write.value & 0xFF;
+            if (step.write.count > 1)
+                memory[step.write.address + 1] = (step.write.value >> 8) & 0xFF;
+
+            invalidate_instructions(sim.cache, step.write);
+        }
     }
 
-    std::string print_instruction(const instruction& inst)
+    // prints every executed instruction with its execution count and share of the estimated cycles, most expensive first
+    void print_profile(machine& sim)
     {
-        const char* mnemonic = get_mneumonic(inst.op);
+        std::cout << "\nProfile:\n" << std::vformat("{:>12} {:>7} {:>10}  {:>6}  instruction\n", std::make_format_args("cycles", "share", "count", "ip"));
 
-        auto matcher = overloaded
+        std::array<char, line_buffer_size> instruction_text{};
+
+        for (const uint16_t ip : get_hot_addresses(sim.profile))
         {
-            [&inst](const effective_address_expression& address_op)
-            {
-                std::string address_text = print_width(inst) + " ["s + get_register_name(address_op.term1.reg);
+            const address_profile& entry = sim.profile.addresses[ip];
+            const double share = sim.total_cycles > 0 ? 100.0 * static_cast<double>(entry.cycles) / static_cast<double>(sim.total_cycles) : 0.0;
 
-                if (address_op.term2.has_value())
-                    address_text += " + "s + get_register_name(address_op.term2->reg);
+            // the instruction last decoded at this address, which is what ran there unless the code modified itself
+            const instruction inst = fetch_instruction(sim.cache, *sim.memory, sim.cache.code_begin + ip);
+            const std::string_view text{ instruction_text.data(), format_instruction(instruction_text.data(), inst) };
 
-                if (address_op.displacement > 0)
-                    address_text += " + " + std::to_string(address_op.displacement);
-                else if (address_op.displacement < 0)
-                    address_text += " - " + std::to_string(-address_op.displacement);
+            std::cout << std::vformat("{:>12} {:>6.2f}% {:>10}  {:#06x}  {}\n", std::make_format_args(entry.cycles, share, entry.count, ip, text));
+        }
+    }
 
-                address_text += "]";
-                return address_text;
-            },
-            [&inst](direct_address direct_address_op)
-            {
-                return std::vformat("{} [{}]", std::make_format_args(print_width(inst), direct_address_op.address));
-            },
-            [](register_access register_op) -> std::string
-            {
-                return get_register_name(register_op);
-            },
-            [&inst](immediate immediate_op)
-            {
-                if (has_any_flag(immediate_op.flags, immediate_flags::relative_jump_displacement))
-                {
-                    const int32_t value = immediate_op.value + static_cast<int32_t>(inst.size);
-                    return std::vformat("${:+}", std::make_format_args(value));
-                }
+    // prints each basic block reachable from the entry point with its static cost and successors, and saves it as DOT when asked
+    void print_control_flow(std::span<uint8_t> data, const std::string& dot_path)
+    {
+        const control_flow_graph graph = build_control_flow_graph(data);
+
+        for (const basic_block& block : graph.blocks)
+        {
+            std::cout << std::vformat("{:#06x}-{:#06x}: {} instructions, ", std::make_format_args(block.start, block.end, block.instructions.size()));
 
-                if (has_any_flag(inst.flags, instruction_flags::wide))
-                    return std::to_string(static_cast<uint16_t>(immediate_op.value));
+            if (!block.timing_known)
+                std::cout << "unknown";
+            else if (block.cycles.min == block.cycles.max)
+                std::cout << block.cycles.min;
+            else
+                std::cout << block.cycles.min << ".." << block.cycles.max;
+
+            std::cout << " clocks";
+
+            for (const block_edge& edge : block.successors)
+            {
+                if (edge.target == exit_block)
+                    std::cout << (edge.taken ? " -> exit (taken)" : " -> exit");
                 else
-                    return std::to_string(static_cast<uint8_t>(immediate_op.value));
+                    std::cout << std::vformat(" -> {:#06x}{}", std::make_format_args(graph.blocks[edge.target].start, edge.taken ? " (taken)" : ""));
+            }
 
-            },
-            [](std::monostate) { return ""s; }
-        };
+            if (block.indirect_exit)
+                std::cout << " -> indirect";
 
-        const std::string first_operand = std::visit(matcher, inst.operands[0]);
-        const std::string second_operand = std::visit(matcher, inst.operands[1]);
+            std::cout << '\n';
+        }
+
+        if (!dot_path.empty())
+        {
+            std::ofstream dot_file{ dot_path };
+            dot_file << format_control_flow_dot(graph);
 
-        std::string asm_line = mnemonic;
-        if (first_operand.length() != 0)
-            asm_line += " " + first_operand;
-        if (second_operand.length() != 0)
-            asm_line += ", " + second_operand;
+            if (!dot_file)
+                throw std::runtime_error{ "Cannot write control flow graph file." };
 
-        return asm_line;
+            std::cout << "\nSaved control flow graph to '" << dot_path << "'.\n";
+        }
     }
 
-    void print_state_transition(std::ostringstream& stream, const char* destination_register, int width, uint16_t old_value, uint16_t new_value)
+    // writes the program out as C++ with a function per basic block
+    void write_recompiled_program(std::span<uint8_t> data, const std::string& program_name, const std::string& recompile_path)
     {
-        stream << std::left << std::setw(width) << std::fixed << std::setfill(' ');
-        stream << std::vformat("{}:{:#x}->{:#x}", std::make_format_args(destination_register, old_value, new_value));
+        const program_translation translation = translate_program(data, program_name);
+
+        std::ofstream source_file{ recompile_path };
+        source_file << translation.source;
+
+        if (!source_file)
+            throw std::runtime_error{ "Cannot write recompiled program file." };
+
+        std::cout << "Translated " << translation.translated_block_count << " of " << translation.block_count << " basic blocks into '" << recompile_path << "'.\n";
     }
 
-    void print_flags_transition(std::ostringstream& stream, const char* flag_register, int width, const simulation_step& step)
+    // runs the loaded program through simulate_instruction and the threaded engine side by side, stopping at the first step they disagree on
+    void print_engine_comparison(machine& sim, std::span<const uint8_t> program, uint64_t max_instructions)
     {
-        stream << std::left << std::setw(width) << std::fixed << std::setfill(' ');
-        stream << std::vformat("{}:{}->{}", std::make_format_args(flag_register, get_flag_string(step.old_flags), get_flag_string(step.new_flags)));
+        machine threaded_sim = create_machine();
+        place_program(threaded_sim, program, sim.registers[code_segment_index]);
+
+        const engine_divergence divergence = compare_engines(sim, threaded_sim, max_instructions);
+
+        if (!divergence.found)
+        {
+            std::cout << "Engines agree on all " << sim.instruction_count << " instructions.\n";
+            return;
+        }
+
+        std::array<char, line_buffer_size> line_buffer{};
+        const instruction inst = fetch_instruction(sim.cache, *sim.memory, sim.cache.code_begin + divergence.ip);
+        const std::string_view text{ line_buffer.data(), format_instruction(line_buffer.data(), inst) };
+
+        std::cout << std::vformat("Engines diverge at instruction {} ({:#06x}: {})\n", std::make_format_args(divergence.instruction_index, divergence.ip, text));
+
+        const std::string_view reference_text{ line_buffer.data(), format_simulation_step(line_buffer.data(), divergence.reference_step) };
+        std::cout << "  reference: " << reference_text << '\n';
+
+        const std::string_view threaded_text{ line_buffer.data(), format_simulation_step(line_buffer.data(), divergence.threaded_step) };
+        std::cout << "   threaded: " << threaded_text << '\n';
+
+        std::cout << "\nReference registers:\n" << print_register_contents(sim.registers);
+        std::cout << "\nThreaded registers:\n" << print_register_contents(threaded_sim.registers);
     }
 
-    void print_literal(std::ostringstream& stream, const char* literal, int width)
+    // runs the program from a freshly reset machine at least min_runs times, and until min_runs runs in a row fail to beat the fastest
+    void run_repetition_test(machine& sim, std::span<const uint8_t> program, const run_limits& limits, uint64_t min_runs)
     {
-        stream << std::left << std::setw(width) << std::fixed << std::setfill(' ') << literal;
+        struct run_measurement
+        {
+            uint64_t ticks{};
+            uint64_t page_faults{};
+        };
+
+        const auto code_segment = sim.registers[code_segment_index];
+        const uint64_t timer_frequency = estimate_cpu_timer_frequency();
+
+        run_measurement fastest{ .ticks = UINT64_MAX };
+        run_measurement slowest{};
+        run_measurement total{};
+        uint64_t run_count = 0;
+        uint64_t runs_since_fastest = 0;
+
+        while (run_count < min_runs || runs_since_fastest < min_runs)
+        {
+            // only the run itself is timed, not putting the machine back the way it was
+            reset_machine(sim);
+            place_program(sim, program, code_segment);
+
+            const uint64_t page_faults_start = read_page_fault_count();
+            const uint64_t timer_start = read_cpu_timer();
+
+            run_machine(sim, limits);
+
+            const run_measurement run
+            {
+                .ticks = read_cpu_timer() - timer_start,
+                .page_faults = read_page_fault_count() - page_faults_start
+            };
+
+            ++run_count;
+            ++runs_since_fastest;
+            total.ticks += run.ticks;
+            total.page_faults += run.page_faults;
+
+            if (run.ticks < fastest.ticks)
+            {
+                fastest = run;
+                runs_since_fastest = 0;
+            }
+
+            if (run.ticks > slowest.ticks)
+                slowest = run;
+        }
+
+        const double frequency = static_cast<double>(timer_frequency);
+        const double instruction_count = static_cast<double>(std::max(sim.instruction_count, uint64_t{ 1 }));
+
+        std::cout << std::vformat("Ran {} times, {} instructions each, with the cpu timer at {:.3f} GHz\n",
+            std::make_format_args(run_count, sim.instruction_count, frequency / 1e9));
+
+        const auto print_measurement = [&](const char* label, double ticks, double page_faults)
+        {
+            const double milliseconds = 1000.0 * ticks / frequency;
+            const double ticks_per_instruction = ticks / instruction_count;
+
+            std::cout << std::vformat("{:>6}: {:.3f} ms, {:.0f} ticks, {:.2f} ticks/instruction, {:.1f} page faults\n",
+                std::make_format_args(label, milliseconds, ticks, ticks_per_instruction, page_faults));
+        };
+
+        const double runs = static_cast<double>(run_count);
+        print_measurement("Min", static_cast<double>(fastest.ticks), static_cast<double>(fastest.page_faults));
+        print_measurement("Max", static_cast<double>(slowest.ticks), static_cast<double>(slowest.page_faults));
+        print_measurement("Mean", static_cast<double>(total.ticks) / runs, static_cast<double>(total.page_faults) / runs);
     }
 
-    void print_empty_column(std::ostringstream& stream, int width)
+    // prints a saved binary trace the way it was printed during execution, or as CSV
+    void print_trace(const std::string& path, bool csv, machine& sim)
     {
-        print_literal(stream, "", width);
+        trace_reader reader = open_trace_reader(path.c_str());
+
+        if (csv)
+            std::cout << "step,ip,instruction,destination,old_value,new_value,old_ip,new_ip,old_flags,new_flags,write_address,write_count\n";
+
+        std::array<char, line_buffer_size> line_buffer{};
+        char* const line_start = line_buffer.data();
+
+        uint64_t step_index = 0;
+        simulation_step step{};
+
+        while (read_trace_step(reader, step))
+        {
+            // memory writes are replayed as well, so self-modifying code decodes the same way it did during execution
+            const instruction inst = fetch_instruction(sim.cache, *sim.memory, sim.cache.code_begin + step.old_ip);
+            char* line_end = line_start;
+
+            if (csv)
+            {
+                const bool has_destination = (step.destination.count != 0);
+                const char* destination = has_destination ? get_register_name(step.destination) : "";
+
+                line_end = std::format_to(line_end, "{},{},\"", step_index, step.old_ip);
+                line_end = format_instruction(line_end, inst);
+                line_end = std::format_to(line_end, "\",{},{},{},{},{},{},{},{},{}\n",
+                    destination, step.old_value, step.new_value, step.old_ip, step.new_ip,
+                    get_flag_text(step.old_flags), get_flag_text(step.new_flags), step.write.address, step.write.count);
+            }
+            else
+            {
+                constexpr size_t column_width = 24;
+                line_end = pad_column(line_start, format_instruction(line_start, inst), column_width);
+                line_end = std::ranges::copy(" ; "sv, line_end).out;
+                line_end = format_simulation_step(line_end, step);
+                *line_end++ = '\n';
+            }
+
+            {
+                PROFILE_ZONE("std::cout");
+                std::cout.write(line_start, line_end - line_start);
+            }
+
+            apply_trace_step(step, sim);
+            ++step_index;
+        }
+
+        if (!csv)
+        {
+            const std::string register_contents = print_register_contents(sim.registers);
+            std::cout << "\nFinal registers:\n" << register_contents;
+        }
     }
-    
-    std::string print_simulation_step(const simulation_step& step)
+
+    // moves one step forward, replaying the log when earlier steps were undone; returns false at the end of the program
+    bool debug_step_forward(time_travel_log& log, machine& sim, char* line_start)
     {
-        constexpr int column_width = 20;
-        std::ostringstream builder;
+        const uint32_t address = sim.cache.code_begin + sim.registers[instruction_pointer_index];
+        const bool replaying = (log.position < log.steps.size());
+
+        if (!replaying && address >= sim.cache.code_end)
+            return false;
+
+        const instruction inst = fetch_instruction(sim.cache, *sim.memory, address);
+        simulation_step step{};
 
-        if (step.new_value != step.old_value)
+        if (replaying)
         {
-            const char* destination_register = get_register_name(step.destination);
-            print_state_transition(builder, destination_register, column_width, step.old_value, step.new_value);
+            step = redo_step(log, sim.registers, *sim.memory);
+            invalidate_instructions(sim.cache, step.write);
         }
         else
         {
-            print_empty_column(builder, column_width);
+            step = step_machine(sim);
+            record_step(log, step, sim.registers, *sim.memory);
         }
 
-        const auto ip_name = get_register_name({ .index = instruction_pointer_index, .offset = 0, .count = 2 });
-        print_state_transition(builder, ip_name, column_width, step.old_ip, step.new_ip);
+        constexpr size_t column_width = 24;
+        char* line_end = std::format_to(line_start, "{:>8}  ", log.position);
+        line_end = pad_column(line_end, format_instruction(line_end, inst), column_width);
+        line_end = std::ranges::copy(" ; "sv, line_end).out;
+        line_end = format_simulation_step(line_end, step);
+        *line_end++ = '\n';
+        std::cout.write(line_start, line_end - line_start);
 
-        if (step.new_flags != step.old_flags)
+        return true;
+    }
+
+    // interactive stepping through a program, backwards as well as forwards
+    void run_debugger(uint64_t checkpoint_interval, machine& sim)
+    {
+        register_array& registers = sim.registers;
+        memory_array& memory = *sim.memory;
+        decode_cache& cache = sim.cache;
+
+        time_travel_log log = start_time_travel(checkpoint_interval, registers, memory);
+
+        std::array<char, line_buffer_size> line_buffer{};
+        char* const line_start = line_buffer.data();
+
+        std::cout << "Commands: s [count] (step), b [count] (back), g index (go to step), c (continue), r (registers), q (quit)\n";
+
+        std::string line;
+        while (std::cout << "\n[" << log.position << "] > " && std::getline(std::cin, line))
         {
-            const auto flags_name = get_register_name({ .index = flags_index, .offset = 0, .count = 2 });
-            print_flags_transition(builder, flags_name, 10, step);
+            std::istringstream command_stream{ line };
+            std::string command;
+            std::string count_text;
+            command_stream >> command >> count_text;
+
+            uint64_t count = 1;
+            if (!count_text.empty() && !parse_count(count_text, count))
+            {
+                std::cout << "Invalid count '" << count_text << "'.\n";
+                continue;
+            }
+
+            if (command == "s")
+            {
+                for (uint64_t i = 0; i < count && debug_step_forward(log, sim, line_start); ++i) {}
+            }
+            else if (command == "c")
+            {
+                while (debug_step_forward(log, sim, line_start)) {}
+            }
+            else if (command == "b")
+            {
+                for (uint64_t i = 0; i < count && log.position > 0; ++i)
+                    invalidate_instructions(cache, undo_step(log, registers, memory).write);
+            }
+            else if (command == "g")
+            {
+                if (count <= log.steps.size())
+                {
+                    // restoring a checkpoint replaces memory wholesale
+                    seek_step(log, count, registers, memory);
+                    invalidate_all_instructions(cache);
+                }
+                else
+                {
+                    seek_step(log, log.steps.size(), registers, memory);
+                    invalidate_all_instructions(cache);
+
+                    while (log.position < count && debug_step_forward(log, sim, line_start)) {}
+                }
+            }
+            else if (command == "r")
+            {
+                std::cout << print_register_contents(registers);
+            }
+            else if (command == "q")
+            {
+                break;
+            }
+            else if (!command.empty())
+            {
+                std::cout << "Unknown command '" << command << "'.\n";
+            }
         }
 
-        return builder.str();
+        std::cout << "\nFinal registers:\n" << print_register_contents(registers);
     }
 
-    std::string print_cycle_estimate(int32_t current_cycles, int32_t base, int32_t ea, uint32_t total_cycles)
+    const char* get_stop_name(stop_reason stop)
     {
-        std::string estimate = std::vformat("Clocks: {:+} = {}", std::make_format_args(current_cycles, total_cycles));
-        if (ea != 0)
-            estimate += std::vformat(" ({} + {}ea)", std::make_format_args(base, ea));
-
-        constexpr int column_width = 28;
-        std::ostringstream stream;
-        stream << std::left << std::setw(column_width) << std::fixed << std::setfill(' ');
-        stream << estimate;
-
-        return stream.str();
+        return stop == stop_reason::cycle_budget ? "cycle" : "instruction";
     }
 
-    std::string print_register_contents(const register_array& registers)
+    // decodes, and when executing also simulates, one instruction at a time, printing a line for each
+    stop_reason run_with_listing(machine& sim, std::span<uint8_t> data, const run_limits& limits, bool execute_mode, bool show_clocks, trace_writer* trace)
     {
-        std::ostringstream builder;
+        const auto code_size = static_cast<uint32_t>(data.size());
+        uint32_t current_address = 0;
 
-        for (size_t i = 0; i < registers.size(); ++i)
+        std::array<char, line_buffer_size> line_buffer{};
+
+        while (current_address < code_size)
         {
-            const uint16_t reg_value = registers[i];
-            if (reg_value == 0)
-                continue;
+            if (sim.instruction_count >= limits.max_instructions)
+                return stop_reason::instruction_budget;
 
-            const auto index = static_cast<register_index>(i);
-            char const* register_name = get_register_name({ .index = index, .offset = 0, .count = 2 });
+            if (static_cast<uint64_t>(sim.total_cycles) >= limits.max_cycles)
+                return stop_reason::cycle_budget;
 
-            if (i == flags_index)
+            // decode instruction, reusing earlier decodings of the same address when executing
+            instruction inst{};
+
+            if (execute_mode)
             {
-                const auto flags = control_flags{ registers[flags_index] };
-                builder << std::vformat("{0: >8}: {1}\n", std::make_format_args(register_name, get_flag_string(flags)));
+                inst = fetch_instruction(sim.cache, *sim.memory, sim.cache.code_begin + current_address);
             }
             else
             {
-                builder << std::vformat("{0: >8}: {1:#06x} ({1:d})\n", std::make_format_args(register_name, reg_value));
+                auto data_iter = data.begin() + current_address;
+                inst = decode_instruction(data_iter, data.end(), current_address);
+            }
+
+            current_address += inst.size;
+
+            // format the whole line into one buffer and write it out at once
+            char* const line_start = line_buffer.data();
+            char* line_end = line_start;
+
+            try
+            {
+                // print instruction
+                constexpr size_t column_width = 24;
+                line_end = pad_column(line_start, format_instruction(line_start, inst), column_width);
+
+                // execute instruction?
+                if (execute_mode)
+                {
+                    simulation_step step = step_machine(sim);
+                    current_address = step.new_ip;
+
+                    if (trace)
+                        write_trace_step(*trace, step);
+
+                    line_end = std::ranges::copy(" ; "sv, line_end).out;
+
+                    // timing was worked out when the instruction was decoded
+                    if (limits.estimate_clocks)
+                    {
+                        const step_timing timing = charge_step_cycles(sim, limits, step, inst);
+
+                        if (show_clocks)
+                        {
+                            line_end = format_cycle_estimate(line_end, timing.cycles + timing.stall, timing.base, timing.ea, timing.penalty, timing.stall, sim.total_cycles);
+                            line_end = std::ranges::copy(" | "sv, line_end).out;
+                        }
+                    }
+
+                    line_end = format_simulation_step(line_end, step);
+                }
+                else if (show_clocks)
+                {
+                    // without running there is no outcome, so branches show both of their costs
+                    line_end = std::ranges::copy(" ; "sv, line_end).out;
+
+                    cycle_estimate estimate{};
+                    if (try_estimate_cycles(inst, estimate))
+                        line_end = format_cycle_interval(line_end, estimate.base, estimate.ea);
+                    else
+                        line_end = std::ranges::copy("Clocks: ?"sv, line_end).out;
+                }
+            }
+            catch (...)
+            {
+                // keep the part of the line that was formatted before the failure
+                std::cout.write(line_start, line_end - line_start);
+                throw;
             }
+
+            *line_end++ = '\n';
+
+            PROFILE_ZONE("std::cout");
+            std::cout.write(line_start, line_end - line_start);
         }
 
-        return builder.str();
+        return stop_reason::finished;
+    }
+
+    // runs every program listed in a batch file across a pool of threads and prints a summary line for each
+    void run_batch_file(const std::string& path, unsigned thread_count, bool lockstep, uint64_t max_instructions, uint64_t max_cycles, cpu_model model)
+    {
+        const std::vector<batch_job> jobs = read_batch_file(path);
+        const run_limits limits
+        {
+            .max_instructions = max_instructions,
+            .max_cycles = max_cycles,
+            .estimate_clocks = max_cycles != no_budget,
+            .model = model
+        };
+
+        const auto batch_start = std::chrono::steady_clock::now();
+        const std::vector<batch_result> results = run_batch(jobs, limits, thread_count, lockstep);
+        const double batch_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch_start).count();
+
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            const batch_result& result = results[i];
+            std::cout << jobs[i].path << ": ";
+
+            if (!result.error.empty())
+            {
+                std::cout << "ERROR!! " << result.error << '\n';
+                continue;
+            }
+
+            std::cout << result.instruction_count << " instructions";
+
+            if (limits.estimate_clocks)
+                std::cout << ", " << result.total_cycles << " cycles";
+
+            if (result.stop != stop_reason::finished)
+                std::cout << " (stopped at the " << get_stop_name(result.stop) << " budget)";
+
+            for (size_t reg = 0; reg < result.registers.size(); ++reg)
+            {
+                if (result.registers[reg] == 0)
+                    continue;
+
+                const char* register_name = get_register_name({ .index = static_cast<register_index>(reg), .offset = 0, .count = 2 });
+
+                if (reg == flags_index)
+                    std::cout << ' ' << register_name << '=' << get_flag_text(control_flags{ result.registers[reg] });
+                else
+                    std::cout << std::vformat(" {}={:#06x}", std::make_format_args(register_name, result.registers[reg]));
+            }
+
+            std::cout << '\n';
+        }
+
+        std::cout << std::vformat("\nRan {} programs in {:.3f} ms\n", std::make_format_args(jobs.size(), batch_milliseconds));
     }
 
-    void save_memory_dump(const char* path, const memory_array& memory_dump)
+    void run_decode_benchmark(std::span<uint8_t> data)
     {
-        std::ofstream output_stream{ path, std::ios::binary };
+        using benchmark_clock = std::chrono::steady_clock;
+        constexpr auto min_duration = std::chrono::seconds{ 2 };
+
+        uint64_t pass_count = 0;
+        uint64_t instruction_count = 0;
+
+        const auto start = benchmark_clock::now();
+        auto elapsed = benchmark_clock::duration{};
+
+        // decode the whole program repeatedly in a linear sweep
+        do
+        {
+            auto data_iter = data.begin();
+            uint32_t current_address = 0;
 
-        if (!output_stream)
-            throw std::exception{ "Cannot write to memory dump file." };
+            while (data_iter < data.end())
+            {
+                const instruction inst = decode_instruction(data_iter, data.end(), current_address);
+                current_address += inst.size;
+                ++instruction_count;
+            }
 
-        for (const uint8_t b : memory_dump)
-            output_stream << b;
+            ++pass_count;
+            elapsed = benchmark_clock::now() - start;
+        }
+        while (elapsed < min_duration);
 
-        output_stream.close();
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        const double megabytes = static_cast<double>(pass_count * data.size()) / (1024.0 * 1024.0);
+        const double megabytes_per_second = megabytes / seconds;
+        const double instructions_per_second = static_cast<double>(instruction_count) / seconds;
+
+        std::cout << std::vformat("Decoded {} instructions ({:.2f} MB) in {:.3f} s\n", std::make_format_args(instruction_count, megabytes, seconds));
+        std::cout << std::vformat("Throughput: {:.2f} MB/s, {:.0f} instructions/s\n", std::make_format_args(megabytes_per_second, instructions_per_second));
     }
 }
 
 int main(int argc, char* argv[])
 {
+    PROFILE_REPORT_AT_EXIT();
+
     // read command line arguments
     constexpr int min_expected_args = 2;
-    constexpr const char* usage_message = "Usage: InstructionDecode8086 [-exec] [-dump] [-showclocks] input_file";
+    constexpr const char* usage_message = "Usage: InstructionDecode8086 [-exec] [-dump] [-showclocks] [-benchdecode] [-showtiming] [-deltadump] [-expanddump]"
+        " [-quiet] [-maxinstructions=count] [-maxcycles=count] [-trace=file] [-readtrace=file] [-csv] [-debug] [-checkpointinterval=count]"
+        " [-batch] [-threads=count] [-lockstep] [-cpu=8086|8088] [-prefetch] [-profile] [-cfg] [-dot=file] [-bench=count] [-threaded] [-fuse] [-compareengines] [-recompile=file] input_file";
 
     if (argc < min_expected_args)
     {
@@ -237,17 +707,59 @@ int main(int argc, char* argv[])
 
     constexpr int not_found = -1;
     int invalid_option_index = not_found;
-    const std::unordered_set<std::string> valid_options = { "-exec", "-dump", "-showclocks" };
 
-    std::unordered_set<std::string> options;
+    // option names, and whether each one takes a value after '='
+    const std::unordered_map<std::string, bool> valid_options =
+    {
+        { "-exec", false },
+        { "-dump", false },
+        { "-showclocks", false },
+        { "-benchdecode", false },
+        { "-showtiming", false },
+        { "-deltadump", false },
+        { "-expanddump", false },
+        { "-quiet", false },
+        { "-maxinstructions", true },
+        { "-maxcycles", true },
+        { "-trace", true },
+        { "-readtrace", true },
+        { "-csv", false },
+        { "-debug", false },
+        { "-checkpointinterval", true },
+        { "-batch", false },
+        { "-threads", true },
+        { "-lockstep", false },
+        { "-cpu", true },
+        { "-prefetch", false },
+        { "-profile", false },
+        { "-cfg", false },
+        { "-dot", true },
+        { "-bench", true },
+        { "-threaded", false },
+        { "-fuse", false },
+        { "-compareengines", false },
+        { "-recompile", true }
+    };
+
+    std::unordered_map<std::string, std::string> options;
     for (int i = 1; i < (argc - 1); ++i)
     {
         std::string option = argv[i];
+        std::string value;
+
+        const size_t separator = option.find('=');
+        const bool has_value = (separator != std::string::npos);
+        if (has_value)
+        {
+            value = option.substr(separator + 1);
+            option.resize(separator);
+        }
+
         std::ranges::transform(option, option.begin(), [](char c) { return std::tolower(c); });
 
-        if (valid_options.contains(option))
+        if (const auto valid_option = valid_options.find(option); valid_option != valid_options.end() && valid_option->second == has_value)
         {
-            options.insert(option);
+            options[option] = value;
         }
         else
         {
@@ -262,10 +774,96 @@ int main(int argc, char* argv[])
         app_args = sim86_arguments
         {
             .input_path = argv[argc - 1],
-            .execute_mode = options.contains("-exec"),
+            .execute_mode = options.contains("-exec") || options.contains("-quiet") || options.contains("-profile"),
             .dump_memory = options.contains("-dump"),
-            .show_clocks = options.contains("-showclocks")
+            .show_clocks = options.contains("-showclocks"),
+            .benchmark_decoding = options.contains("-benchdecode"),
+            .show_timing = options.contains("-showtiming"),
+            .delta_dump = options.contains("-deltadump"),
+            .expand_dump = options.contains("-expanddump"),
+            .quiet = options.contains("-quiet"),
+            .trace_path = options["-trace"],
+            .read_trace_path = options["-readtrace"],
+            .csv = options.contains("-csv"),
+            .debug = options.contains("-debug"),
+            .batch = options.contains("-batch"),
+            .lockstep = options.contains("-lockstep"),
+            .model_prefetch = options.contains("-prefetch"),
+            .profile = options.contains("-profile"),
+            .control_flow = options.contains("-cfg") || options.contains("-dot"),
+            .dot_path = options["-dot"],
+            .threaded = options.contains("-threaded"),
+            .fused = options.contains("-fuse"),
+            .compare_engines = options.contains("-compareengines"),
+            .recompile_path = options["-recompile"]
         };
+
+        const auto counts = { std::pair{ "-maxinstructions", &app_args.max_instructions }, std::pair{ "-maxcycles", &app_args.max_cycles },
+            std::pair{ "-checkpointinterval", &app_args.checkpoint_interval }, std::pair{ "-bench", &app_args.bench_runs } };
+        uint64_t thread_count = 0;
+
+        for (const auto& [option, budget] : counts)
+        {
+            if (options.contains(option) && !parse_count(options[option], *budget))
+            {
+                std::cout << "Invalid count '" << options[option] << "' for " << option << ".\n\n" << usage_message << '\n';
+                return EXIT_FAILURE;
+            }
+        }
+
+        // a repetition test of no runs would quietly fall through to a normal run
+        if (options.contains("-bench") && app_args.bench_runs == 0)
+        {
+            std::cout << "Invalid count '" << options["-bench"] << "' for -bench.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
+
+        // zero threads means one per core
+        if (options.contains("-threads") && (!parse_count(options["-threads"], thread_count) || thread_count > UINT16_MAX))
+        {
+            std::cout << "Invalid count '" << options["-threads"] << "' for -threads.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
+
+        app_args.thread_count = static_cast<unsigned>(thread_count);
+
+        // the target only changes cycle estimates
+        if (const std::string& cpu = options["-cpu"]; cpu == "8088")
+        {
+            app_args.model = cpu_model::i8088;
+        }
+        else if (!cpu.empty() && cpu != "8086")
+        {
+            std::cout << "Unknown CPU '" << cpu << "' for -cpu.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
+
+        // the listing steps through simulate_instruction, so it would quietly ignore the engine choice
+        if (app_args.threaded && !app_args.quiet && app_args.bench_runs == 0)
+        {
+            std::cout << "-threaded needs -quiet or -bench.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
+
+        // a fused pair reports a single step, so fusing is off for anything that needs every step or its clocks
+        if (app_args.fused && !app_args.quiet && app_args.bench_runs == 0)
+        {
+            std::cout << "-fuse needs -quiet or -bench.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
+
+        if (app_args.fused && (!app_args.trace_path.empty() || app_args.show_clocks || app_args.max_cycles != no_budget || app_args.model_prefetch || app_args.profile))
+        {
+            std::cout << "-fuse cannot be combined with -trace, -showclocks, -maxcycles, -prefetch or -profile.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
+
+        // every repetition starts from a reset machine and only its timing is reported, so these would be quietly dropped
+        if (app_args.bench_runs != 0 && (!app_args.trace_path.empty() || app_args.profile || app_args.dump_memory || app_args.delta_dump))
+        {
+            std::cout << "-bench cannot be combined with -trace, -profile, -dump or -deltadump.\n\n" << usage_message << '\n';
+            return EXIT_FAILURE;
+        }
     }
     else
     {
@@ -273,107 +871,205 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    // outside the try, so a run that fails still saves the steps it traced
+    std::optional<trace_writer> trace;
+
     try
     {
         std::string input_filename = std::filesystem::path(app_args.input_path).filename().string();
-        const char* action = app_args.execute_mode ? "execution" : "decoding";
-        std::cout << "--- " << input_filename << " " << action << " --- \n\n";
+        const bool reading_trace = !app_args.read_trace_path.empty();
+        const char* action = app_args.batch ? "batch" : app_args.control_flow ? "control flow" : !app_args.recompile_path.empty() ? "recompilation" : app_args.compare_engines ? "engine comparison" : app_args.bench_runs != 0 ? "repetition test" : (app_args.execute_mode || reading_trace || app_args.debug) ? "execution" : "decoding";
+
+        if (!(reading_trace && app_args.csv))
+            std::cout << "--- " << input_filename << " " << action << " --- \n\n";
+
+        if (app_args.batch)
+        {
+            run_batch_file(app_args.input_path, app_args.thread_count, app_args.lockstep, app_args.max_instructions, app_args.max_cycles, app_args.model);
+            return EXIT_SUCCESS;
+        }
+
+        machine sim = create_machine();
+        register_array& registers = sim.registers;
+        memory_array& memory = *sim.memory;
 
-        register_array registers = {};
+        std::chrono::steady_clock::duration load_time{};
 
-        // read binary instructions into a buffer, then copy its contents to the code segment in memory via a view
+        // read binary instructions directly into the code segment in memory
         std::span<uint8_t> data;
         {
-            constexpr int segment_size = 64 * 1024;
             constexpr auto cs_location = 0;
             //constexpr auto cs_location = 65 * 4 * 64;
             //constexpr auto cs_location = memory.size() - segment_size;
 
-            registers[code_segment_index] = cs_location >> 4;
+            const auto load_start = std::chrono::steady_clock::now();
 
-            std::vector<uint8_t> data_buffer = read_binary_file(app_args.input_path);
+            data = load_program(sim, app_args.input_path, cs_location >> 4);
 
-            if (data_buffer.size() > segment_size)
-                throw std::exception{ "Instructions must fit within a single memory segment." };
+            load_time = std::chrono::steady_clock::now() - load_start;
+        }
 
-            uint8_t* code_segment = memory.data() + (registers[code_segment_index] << 4);
-            data = std::span{ code_segment, data_buffer.size() };
-            std::ranges::copy(data_buffer, data.begin());
+        // keep the loaded program for comparing against memory when the run finishes
+        memory_image initial_image{};
+        if (app_args.delta_dump)
+        {
+            initial_image.location = registers[code_segment_index] << 4;
+            initial_image.bytes.assign(data.begin(), data.end());
         }
-        
-        // read instructions
-        auto data_iter = data.begin();
-        const auto data_end = data.end();
 
-        uint32_t current_address = 0;
-        int32_t total_cycles = 0;
+        if (app_args.expand_dump)
+        {
+            // rebuild a full memory dump from the loaded program and a saved delta
+            apply_memory_delta(delta_filename, memory);
+            save_memory_dump(dump_filename, memory);
+            std::cout << "Expanded '" << delta_filename << "' into '" << dump_filename << "'.\n";
+            return EXIT_SUCCESS;
+        }
 
-        // decode instruction
-        while (data_iter < data_end)
+        if (app_args.benchmark_decoding)
         {
-            instruction inst = decode_instruction(data_iter, data_end, current_address);
-            current_address += inst.size;
+            run_decode_benchmark(data);
+            return EXIT_SUCCESS;
+        }
 
-            // print instruction
-            constexpr int column_width = 24;
-            std::string asm_line = print_instruction(inst);
-            std::cout << std::left << std::setw(column_width) << std::fixed << std::setfill(' ');
-            std::cout << asm_line;
+        if (app_args.control_flow)
+        {
+            print_control_flow(data, app_args.dot_path);
+            return EXIT_SUCCESS;
+        }
 
-            // execute instruction?
-            if (app_args.execute_mode)
-            {
-                simulation_step step = simulate_instruction(inst, registers, memory);
+        if (!app_args.recompile_path.empty())
+        {
+            write_recompiled_program(data, input_filename, app_args.recompile_path);
+            return EXIT_SUCCESS;
+        }
 
-                const int32_t actual_ip_change = step.new_ip - step.old_ip;
-                const int32_t delta = (actual_ip_change - static_cast<int32_t>(inst.size));
-                if (delta != 0)
-                    std::advance(data_iter, delta);
+        if (reading_trace)
+        {
+            print_trace(app_args.read_trace_path, app_args.csv, sim);
+            return EXIT_SUCCESS;
+        }
 
-                std::cout << " ; ";
+        if (app_args.debug)
+        {
+            run_debugger(app_args.checkpoint_interval, sim);
+            return EXIT_SUCCESS;
+        }
 
-                if (app_args.show_clocks)
-                {
-                    const cycle_estimate estimate = estimate_cycles(inst);
-                    const int32_t base = (estimate.base.min + estimate.base.max) / 2;
-                    const int32_t ea = estimate.ea;
+        if (app_args.compare_engines)
+        {
+            print_engine_comparison(sim, data, app_args.max_instructions);
+            return EXIT_SUCCESS;
+        }
 
-                    int32_t current_cycles = base + ea;
-                    total_cycles += current_cycles;
+        if (!app_args.trace_path.empty())
+            trace = open_trace_writer(app_args.trace_path.c_str());
 
-                    std::string cycle_line = print_cycle_estimate(current_cycles, base, ea, total_cycles);
-                    std::cout << cycle_line << " | ";
-                }
+        if (app_args.profile)
+            sim.profile = create_execution_profile(static_cast<uint32_t>(data.size()));
 
-                std::string sim_line = print_simulation_step(step);
-                std::cout << sim_line;
-            }
+        // cycles are only estimated when something needs them
+        const run_limits limits
+        {
+            .max_instructions = app_args.max_instructions,
+            .max_cycles = app_args.max_cycles,
+            .estimate_clocks = app_args.show_clocks || app_args.max_cycles != no_budget || app_args.model_prefetch || app_args.profile,
+            .model = app_args.model,
+            .model_prefetch = app_args.model_prefetch,
+            .engine = app_args.fused ? execution_engine::fused : app_args.threaded ? execution_engine::threaded : execution_engine::reference
+        };
 
-            std::cout << '\n';
+        if (app_args.bench_runs != 0)
+        {
+            // keep the loaded program, since the first reset clears memory
+            const std::vector<uint8_t> program(data.begin(), data.end());
+            run_repetition_test(sim, program, limits, app_args.bench_runs);
+            return EXIT_SUCCESS;
+        }
+
+        stop_reason stop = stop_reason::finished;
+
+        const auto run_start = std::chrono::steady_clock::now();
+
+        if (app_args.quiet)
+        {
+            // execute without any per-step output
+            stop = run_machine(sim, limits, trace ? &*trace : nullptr);
+        }
+        else
+        {
+            stop = run_with_listing(sim, data, limits, app_args.execute_mode, app_args.show_clocks, trace ? &*trace : nullptr);
+        }
+
+        const auto run_time = std::chrono::steady_clock::now() - run_start;
+
+        if (trace)
+        {
+            close_trace_writer(*trace);
+            trace.reset();
         }
 
+        if (stop != stop_reason::finished)
+            std::cout << "\nStopped after reaching the " << get_stop_name(stop) << " budget.\n";
+
         if (app_args.execute_mode)
         {
             // print final contents of registers
+            materialize_flags(sim.lazy, registers);
             const std::string register_contents = print_register_contents(registers);
             std::cout << "\nFinal registers:\n" << register_contents;
 
+            if (app_args.quiet)
+            {
+                const double run_seconds = std::chrono::duration<double>(run_time).count();
+                const double run_milliseconds = run_seconds * 1000.0;
+                const double instructions_per_second = run_seconds > 0.0 ? static_cast<double>(sim.instruction_count) / run_seconds : 0.0;
+
+                std::cout << "\nInstructions: " << sim.instruction_count << '\n';
+
+                if (limits.estimate_clocks)
+                    std::cout << "Estimated cycles: " << sim.total_cycles << '\n';
+
+                std::cout << std::vformat("Run time: {:.3f} ms ({:.0f} instructions/s)\n", std::make_format_args(run_milliseconds, instructions_per_second));
+            }
+
+            // stalls are part of the estimated cycles, reported on their own to show how much the queue costs
+            if (limits.model_prefetch)
+                std::cout << "\nPrefetch stall cycles: " << sim.stall_cycles << " of " << sim.total_cycles << '\n';
+
+            if (app_args.profile)
+                print_profile(sim);
+
             if (app_args.dump_memory)
             {
                 // save memory to a file
-                constexpr auto dump_filename = "dump.data";
                 save_memory_dump(dump_filename, memory);
                 std::cout << "\nSaved memory to '" << dump_filename << "'.\n";
             }
+
+            if (app_args.delta_dump)
+            {
+                // save only the memory that changed since loading
+                const size_t delta_size = save_memory_delta(delta_filename, memory, initial_image);
+                std::cout << std::vformat("\nSaved memory changes to '{}' ({} bytes).\n", std::make_format_args(delta_filename, delta_size));
+            }
+        }
+
+        if (app_args.show_timing)
+        {
+            const double load_milliseconds = std::chrono::duration<double, std::milli>(load_time).count();
+            std::cout << std::vformat("\nLoad time: {:.3f} ms\n", std::make_format_args(load_milliseconds));
         }
     }
     catch (std::exception& ex)
     {
+        close_trace_after_error(trace);
         std::cout << "ERROR!! " << ex.what() << '\n';
         return EXIT_FAILURE;
     }
     catch (...)
     {
+        close_trace_after_error(trace);
         std::cout << "UNKNOWN ERROR!!\n";
         return EXIT_FAILURE;
     }
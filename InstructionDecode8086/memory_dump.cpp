@@ -0,0 +1,157 @@
+﻿#include "memory_dump.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+
+namespace
+{
+    // file layout, all values little-endian:
+    //   magic, version, memory size, range count
+    //   per range: address, byte count, bytes
+    constexpr uint32_t delta_magic = 0x44363853; // "S86D"
+    constexpr uint32_t delta_version = 1;
+    constexpr uint32_t dump_page_size = 256;
+
+    static_assert(memory_size % dump_page_size == 0);
+
+    void append_u32(std::vector<uint8_t>& buffer, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            buffer.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    uint32_t read_u32(std::span<const uint8_t> buffer, size_t& position)
+    {
+        if (buffer.size() - position < 4)
+            throw std::runtime_error{ "Memory delta file is truncated." };
+
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+            value |= static_cast<uint32_t>(buffer[position++]) << (8 * i);
+
+        return value;
+    }
+
+    bool page_matches(const memory_array& memory, const memory_image& initial, uint32_t page_start)
+    {
+        static constexpr std::array<uint8_t, dump_page_size> zero_page = {};
+
+        const uint32_t image_end = initial.location + static_cast<uint32_t>(initial.bytes.size());
+        const uint32_t page_end = page_start + dump_page_size;
+
+        if (page_end <= initial.location || page_start >= image_end)
+            return std::memcmp(memory.data() + page_start, zero_page.data(), dump_page_size) == 0;
+
+        for (uint32_t address = page_start; address < page_end; ++address)
+        {
+            const bool in_image = (address >= initial.location && address < image_end);
+            const uint8_t initial_value = in_image ? initial.bytes[address - initial.location] : 0;
+
+            if (memory[address] != initial_value)
+                return false;
+        }
+
+        return true;
+    }
+
+    void write_file(const char* path, const void* data, size_t size)
+    {
+        std::ofstream output_stream{ path, std::ios::binary };
+
+        if (!output_stream)
+            throw std::runtime_error{ "Cannot write to memory dump file." };
+
+        output_stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+
+        if (!output_stream)
+            throw std::runtime_error{ "Cannot write to memory dump file." };
+    }
+}
+
+void save_memory_dump(const char* path, const memory_array& memory)
+{
+    write_file(path, memory.data(), memory.size());
+}
+
+size_t save_memory_delta(const char* path, const memory_array& memory, const memory_image& initial)
+{
+    std::vector<uint8_t> buffer;
+    append_u32(buffer, delta_magic);
+    append_u32(buffer, delta_version);
+    append_u32(buffer, memory_size);
+
+    const size_t range_count_position = buffer.size();
+    append_u32(buffer, 0);
+
+    // runs of consecutive changed pages are stored as a single range
+    uint32_t range_count = 0;
+    uint32_t page_start = 0;
+
+    while (page_start < memory_size)
+    {
+        if (page_matches(memory, initial, page_start))
+        {
+            page_start += dump_page_size;
+            continue;
+        }
+
+        uint32_t range_end = page_start + dump_page_size;
+        while (range_end < memory_size && !page_matches(memory, initial, range_end))
+            range_end += dump_page_size;
+
+        append_u32(buffer, page_start);
+        append_u32(buffer, range_end - page_start);
+        buffer.insert(buffer.end(), memory.begin() + page_start, memory.begin() + range_end);
+
+        ++range_count;
+        page_start = range_end;
+    }
+
+    for (int i = 0; i < 4; ++i)
+        buffer[range_count_position + i] = static_cast<uint8_t>(range_count >> (8 * i));
+
+    write_file(path, buffer.data(), buffer.size());
+
+    return buffer.size();
+}
+
+void apply_memory_delta(const char* path, memory_array& memory)
+{
+    std::ifstream input_stream{ path, std::ios::binary };
+
+    if (!input_stream)
+        throw std::runtime_error{ "Cannot open memory delta file." };
+
+    std::vector<uint8_t> buffer(static_cast<size_t>(std::filesystem::file_size(path)));
+    input_stream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+
+    if (input_stream.gcount() != static_cast<std::streamsize>(buffer.size()))
+        throw std::runtime_error{ "Cannot read memory delta file." };
+
+    size_t position = 0;
+
+    if (read_u32(buffer, position) != delta_magic || read_u32(buffer, position) != delta_version)
+        throw std::runtime_error{ "Unrecognized memory delta file format." };
+
+    if (read_u32(buffer, position) != memory_size)
+        throw std::runtime_error{ "Memory delta file was saved with a different memory size." };
+
+    const uint32_t range_count = read_u32(buffer, position);
+
+    for (uint32_t i = 0; i < range_count; ++i)
+    {
+        const uint32_t address = read_u32(buffer, position);
+        const uint32_t count = read_u32(buffer, position);
+
+        if (address > memory_size || count > memory_size - address || count > buffer.size() - position)
+            throw std::runtime_error{ "Memory delta file has an out-of-range entry." };
+
+        std::copy_n(buffer.begin() + position, count, memory.begin() + address);
+        position += count;
+    }
+}
@@ -0,0 +1,25 @@
+﻿#ifndef WS_MEMORYDUMP_HPP
+#define WS_MEMORYDUMP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simulator.hpp"
+
+// bytes loaded into memory before execution; everything else starts out as zero
+struct memory_image
+{
+    uint32_t location{};
+    std::vector<uint8_t> bytes;
+};
+
+void save_memory_dump(const char* path, const memory_array& memory);
+
+// writes only the pages that differ from the initial image, returning the size of the file
+size_t save_memory_delta(const char* path, const memory_array& memory, const memory_image& initial);
+
+// reads a file written by save_memory_delta and applies it to memory holding the same initial image
+void apply_memory_delta(const char* path, memory_array& memory);
+
+#endif
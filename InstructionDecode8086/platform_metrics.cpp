@@ -0,0 +1,59 @@
+﻿#include "platform_metrics.hpp"
+
+#include <chrono>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#include <intrin.h>
+#else
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+uint64_t read_cpu_timer()
+{
+#if defined(_WIN32) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+#endif
+}
+
+uint64_t estimate_cpu_timer_frequency(uint32_t milliseconds)
+{
+    using calibration_clock = std::chrono::steady_clock;
+
+    const auto wait = std::chrono::milliseconds{ milliseconds };
+    const auto clock_start = calibration_clock::now();
+    const uint64_t timer_start = read_cpu_timer();
+
+    auto elapsed = calibration_clock::duration{};
+    while (elapsed < wait)
+        elapsed = calibration_clock::now() - clock_start;
+
+    const uint64_t timer_ticks = read_cpu_timer() - timer_start;
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+
+    return static_cast<uint64_t>(static_cast<double>(timer_ticks) / seconds);
+}
+
+uint64_t read_page_fault_count()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters{};
+    counters.cb = sizeof(counters);
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+    return counters.PageFaultCount;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+
+    return static_cast<uint64_t>(usage.ru_minflt + usage.ru_majflt);
+#endif
+}
@@ -0,0 +1,15 @@
+﻿#ifndef WS_PLATFORMMETRICS_HPP
+#define WS_PLATFORMMETRICS_HPP
+
+#include <cstdint>
+
+// the processor's time stamp counter where there is one, otherwise the steady clock in nanoseconds
+uint64_t read_cpu_timer();
+
+// cpu timer ticks per second, measured against the steady clock over about the given number of milliseconds
+uint64_t estimate_cpu_timer_frequency(uint32_t milliseconds = 100);
+
+// soft and hard page faults this process has taken so far
+uint64_t read_page_fault_count();
+
+#endif
@@ -0,0 +1,59 @@
+﻿#include "prefetch_queue.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr int32_t bus_cycle_clocks = 4;
+
+    // both load a whole bus width per fetch: the 8086 a word into 6 bytes of queue, the 8088 a byte into 4
+    constexpr int32_t queue_capacity_8086 = 6;
+    constexpr int32_t queue_capacity_8088 = 4;
+}
+
+prefetch_queue create_prefetch_queue(cpu_model model)
+{
+    if (model == cpu_model::i8088)
+        return { .capacity = queue_capacity_8088, .fetch_width = 1 };
+
+    return { .capacity = queue_capacity_8086, .fetch_width = 2 };
+}
+
+int32_t consume_prefetch(prefetch_queue& queue, uint32_t instruction_size, int32_t execute_cycles, int32_t transfers, bool jump_taken)
+{
+    int32_t stall_cycles = 0;
+    auto missing_bytes = static_cast<int32_t>(instruction_size);
+
+    // bytes already queued are free, and the rest arrive one fetch at a time while the execution unit waits
+    const int32_t queued = std::min(queue.queued_bytes, missing_bytes);
+    queue.queued_bytes -= queued;
+    missing_bytes -= queued;
+
+    while (missing_bytes > 0)
+    {
+        stall_cycles += bus_cycle_clocks - queue.bus_progress;
+        queue.bus_progress = 0;
+
+        const int32_t fetched = std::min(queue.fetch_width, missing_bytes);
+        missing_bytes -= fetched;
+        queue.queued_bytes += queue.fetch_width - fetched;
+    }
+
+    // the bus belongs to the instruction's own memory transfers first, and fetches in whatever clocks are left
+    queue.bus_progress += std::max(execute_cycles - transfers * bus_cycle_clocks, 0);
+
+    while (queue.bus_progress >= bus_cycle_clocks && queue.queued_bytes + queue.fetch_width <= queue.capacity)
+    {
+        queue.bus_progress -= bus_cycle_clocks;
+        queue.queued_bytes += queue.fetch_width;
+    }
+
+    // a full queue leaves the bus idle, so no fetch is partway done
+    if (queue.queued_bytes + queue.fetch_width > queue.capacity)
+        queue.bus_progress = 0;
+
+    if (jump_taken)
+        queue = { .capacity = queue.capacity, .fetch_width = queue.fetch_width };
+
+    return stall_cycles;
+}
@@ -0,0 +1,23 @@
+﻿#ifndef WS_PREFETCHQUEUE_HPP
+#define WS_PREFETCHQUEUE_HPP
+
+#include <cstdint>
+
+#include "cycle_estimator.hpp"
+
+// the bus interface unit's instruction queue, which fills during any bus cycle the execution unit leaves free
+struct prefetch_queue
+{
+    int32_t capacity{};
+    int32_t fetch_width{};
+    int32_t queued_bytes{};
+    int32_t bus_progress{}; // clocks spent on the opcode fetch in flight
+};
+
+prefetch_queue create_prefetch_queue(cpu_model model);
+
+// takes one instruction's bytes out of the queue, lets the queue refill while it executes, and returns the clocks the
+// execution unit waited for bytes that were not there yet; a taken jump empties the queue afterwards
+int32_t consume_prefetch(prefetch_queue& queue, uint32_t instruction_size, int32_t execute_cycles, int32_t transfers, bool jump_taken);
+
+#endif
@@ -0,0 +1,127 @@
+﻿#include "recompiled_runtime.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <span>
+
+#include "decode_cache.hpp"
+#include "instruction.hpp"
+#include "platform_metrics.hpp"
+
+namespace
+{
+    constexpr uint64_t timed_runs = 10;
+
+    uint32_t get_code_address(const machine& sim)
+    {
+        return sim.cache.code_begin + sim.registers[instruction_pointer_index];
+    }
+
+    // the fastest of several runs from a freshly placed program, leaving the machine as the last run finished it
+    template <typename run_function>
+    uint64_t time_fastest_run(machine& sim, std::span<const uint8_t> program, run_function run)
+    {
+        uint64_t fastest = UINT64_MAX;
+
+        for (uint64_t i = 0; i < timed_runs; ++i)
+        {
+            reset_machine(sim);
+            place_program(sim, program, 0);
+
+            const uint64_t start = read_cpu_timer();
+            run(sim);
+            fastest = std::min(fastest, read_cpu_timer() - start);
+        }
+
+        materialize_flags(sim.lazy, sim.registers);
+
+        return fastest;
+    }
+}
+
+void run_recompiled(machine& sim, block_dispatch dispatch)
+{
+    bool translation_current = true;
+
+    while (get_code_address(sim) < sim.cache.code_end)
+    {
+        if (translation_current)
+        {
+            const block_result result = dispatch(sim);
+
+            if (result == block_result::ran)
+                continue;
+
+            if (result == block_result::code_modified)
+            {
+                // anything the interpreter decoded earlier may be stale as well
+                invalidate_all_instructions(sim.cache);
+                translation_current = false;
+                continue;
+            }
+        }
+
+        const instruction& inst = fetch_instruction(sim.cache, *sim.memory, get_code_address(sim));
+        const simulation_step step = simulate_instruction(inst, sim.registers, *sim.memory, sim.lazy);
+
+        invalidate_instructions(sim.cache, step.write);
+        ++sim.instruction_count;
+
+        if (step.write.count != 0 && step.write.address < sim.cache.code_end && step.write.address + step.write.count > sim.cache.code_begin)
+            translation_current = false;
+    }
+}
+
+int compare_with_interpreter(const char* program_name, std::span<const uint8_t> program, block_dispatch dispatch)
+{
+    try
+    {
+        std::cout << "--- " << program_name << " recompiled --- \n\n";
+
+        machine interpreted = create_machine();
+        machine threaded = create_machine();
+        machine recompiled = create_machine();
+
+        const uint64_t interpreter_ticks = time_fastest_run(interpreted, program, [](machine& sim) { run_machine(sim, run_limits{}); });
+        const uint64_t threaded_ticks = time_fastest_run(threaded, program, [](machine& sim) { run_machine(sim, run_limits{ .engine = execution_engine::fused }); });
+        const uint64_t recompiled_ticks = time_fastest_run(recompiled, program, [dispatch](machine& sim) { run_recompiled(sim, dispatch); });
+
+        const double ticks_per_millisecond = static_cast<double>(estimate_cpu_timer_frequency()) / 1000.0;
+        const double interpreter_milliseconds = static_cast<double>(interpreter_ticks) / ticks_per_millisecond;
+        const double threaded_milliseconds = static_cast<double>(threaded_ticks) / ticks_per_millisecond;
+        const double recompiled_milliseconds = static_cast<double>(recompiled_ticks) / ticks_per_millisecond;
+
+        const double interpreter_speedup = static_cast<double>(interpreter_ticks) / static_cast<double>(std::max<uint64_t>(recompiled_ticks, 1));
+        const double threaded_speedup = static_cast<double>(threaded_ticks) / static_cast<double>(std::max<uint64_t>(recompiled_ticks, 1));
+
+        std::cout << "Instructions: " << interpreted.instruction_count << "\n\n";
+        std::cout << std::vformat("Fastest of {} runs:\n", std::make_format_args(timed_runs));
+        std::cout << std::vformat("  interpreter: {:>10.3f} ms\n", std::make_format_args(interpreter_milliseconds));
+        std::cout << std::vformat("     threaded: {:>10.3f} ms (fused)\n", std::make_format_args(threaded_milliseconds));
+        std::cout << std::vformat("   recompiled: {:>10.3f} ms\n", std::make_format_args(recompiled_milliseconds));
+        std::cout << std::vformat("\nSpeedup: {:.2f}x over the interpreter, {:.2f}x over the threaded engine\n", std::make_format_args(interpreter_speedup, threaded_speedup));
+
+        const bool same_registers = interpreted.registers == recompiled.registers;
+        const bool same_memory = *interpreted.memory == *recompiled.memory;
+        const bool same_count = interpreted.instruction_count == recompiled.instruction_count;
+
+        if (!same_registers || !same_memory || !same_count)
+        {
+            std::cout << "\nMISMATCH!! The recompiled program finished with different " << (!same_registers ? "registers" : !same_memory ? "memory" : "instruction counts") << ".\n";
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "\nFinal registers and memory match the interpreter.\n";
+    }
+    catch (std::exception& ex)
+    {
+        std::cout << "ERROR!! " << ex.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
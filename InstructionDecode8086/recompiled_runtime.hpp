@@ -0,0 +1,42 @@
+﻿#ifndef WS_RECOMPILEDRUNTIME_HPP
+#define WS_RECOMPILEDRUNTIME_HPP
+
+#include <cstdint>
+#include <span>
+
+#include "machine.hpp"
+#include "simulator.hpp"
+
+// what running the translation of one basic block did
+enum class block_result : uint8_t
+{
+    no_block,     // ip is not the start of a translated block, so the interpreter has to run the next instruction
+    ran,          // ip is wherever the block went
+    code_modified // a write landed in the code, so the translations may no longer match it
+};
+
+// runs the translated block that starts at the machine's ip, if there is one
+using block_dispatch = block_result (*)(machine& sim);
+
+// stores the way simulate_instruction does for a memory destination, returning whether the write touched the code
+inline bool store_recompiled(machine& sim, uint32_t address, uint16_t value, bool wide)
+{
+    memory_array& memory = *sim.memory;
+    memory[address] = value & 0xFF;
+
+    if (wide)
+        memory[address + 1] = (value >> 8) & 0xFF;
+
+    const uint32_t write_end = address + (wide ? 2 : 1);
+    return address < sim.cache.code_end && write_end > sim.cache.code_begin;
+}
+
+// runs translated blocks wherever there are some and interprets everything else, until ip leaves the code; once the code
+// has been written to, the rest of the program is interpreted
+void run_recompiled(machine& sim, block_dispatch dispatch);
+
+// runs the program in the interpreter and through its translation, checks they leave the same registers and memory, and
+// reports how much faster the translation ran; returns a process exit code
+int compare_with_interpreter(const char* program_name, std::span<const uint8_t> program, block_dispatch dispatch);
+
+#endif
@@ -1,31 +1,59 @@
 ﻿#include "simulator.hpp"
 
+#include <array>
 #include <bit>
 #include <cstdint>
 #include <limits>
-#include <unordered_map>
+#include <stdexcept>
+#include <utility>
 #include <variant>
 
 #include "flag_utils.hpp"
 #include "overloaded.hpp"
 #include "instruction.hpp"
 #include "register_access.hpp"
+#include "zone_profiler.hpp"
 
 namespace
 {
-    std::unordered_map<control_flags, char> flag_names
+    constexpr std::array flag_names =
     {
-        { control_flags::carry, 'C' },
-        { control_flags::parity, 'P' },
-        { control_flags::aux_carry, 'A' },
-        { control_flags::zero, 'Z' },
-        { control_flags::sign, 'S' },
-        { control_flags::trap, 'T' },
-        { control_flags::interrupt, 'I' },
-        { control_flags::direction, 'D' },
-        { control_flags::overflow, 'O' }
+        std::pair{ control_flags::carry, 'C' },
+        std::pair{ control_flags::parity, 'P' },
+        std::pair{ control_flags::aux_carry, 'A' },
+        std::pair{ control_flags::zero, 'Z' },
+        std::pair{ control_flags::sign, 'S' },
+        std::pair{ control_flags::trap, 'T' },
+        std::pair{ control_flags::interrupt, 'I' },
+        std::pair{ control_flags::direction, 'D' },
+        std::pair{ control_flags::overflow, 'O' }
     };
 
+    struct flag_text
+    {
+        std::array<char, flag_names.size()> chars{};
+        uint8_t length{};
+    };
+
+    constexpr size_t flag_combination_count = 0x1000;
+
+    // text for every combination of the named flags, in bit order
+    constexpr std::array<flag_text, flag_combination_count> flag_texts = []
+    {
+        std::array<flag_text, flag_combination_count> texts{};
+
+        for (size_t i = 0; i < texts.size(); ++i)
+        {
+            for (const auto& [flag, name] : flag_names)
+            {
+                if (has_all_flags(control_flags{ static_cast<uint16_t>(i) }, flag))
+                    texts[i].chars[texts[i].length++] = name;
+            }
+        }
+
+        return texts;
+    }();
+
     struct simulator_numeric_limits
     {
         int32_t min_signed{};
@@ -73,7 +101,7 @@ namespace
                 };
 
             default:
-                throw std::exception{ "Unexpected numeric width type." };
+                throw std::runtime_error{ "Unexpected numeric width type." };
         }
     }
 
@@ -137,39 +165,101 @@ namespace
         }
         else
         {
-            throw std::exception{ "Instruction operand type does not represent an address." };
+            throw std::runtime_error{ "Instruction operand type does not represent an address." };
         }
 
         return address;
     }
 
-    void store_value(uint16_t value, uint32_t address, const instruction_flags& flags, memory_array& memory)
+    memory_write store_value(uint16_t value, uint32_t address, const instruction_flags& flags, memory_array& memory)
     {
+        const uint16_t old_low = memory[address];
         memory[address] = value & 0xFF;
 
         if (has_any_flag(flags, instruction_flags::wide))
+        {
+            const uint16_t old_high = memory[address + 1];
             memory[address + 1] = (value >> 8) & 0xFF;
+            return { .address = address, .count = 2, .value = value, .old_value = static_cast<uint16_t>(old_low | (old_high << 8)) };
+        }
+
+        return { .address = address, .count = 1, .value = static_cast<uint16_t>(value & 0xFF), .old_value = old_low };
     }
+
+    bool reads_flags(operation_type op)
+    {
+        switch (op)
+        {
+            case operation_type::je:
+            case operation_type::jl:
+            case operation_type::jle:
+            case operation_type::jb:
+            case operation_type::jbe:
+            case operation_type::jp:
+            case operation_type::jo:
+            case operation_type::js:
+            case operation_type::jne:
+            case operation_type::jnl:
+            case operation_type::jg:
+            case operation_type::jnb:
+            case operation_type::ja:
+            case operation_type::jnp:
+            case operation_type::jno:
+            case operation_type::jns:
+            case operation_type::loopz:
+            case operation_type::loopnz:
+                return true;
+
+            default:
+                return false;
+        }
+    }
+}
+
+bool is_jump_taken(const simulation_step& step, uint32_t instruction_size)
+{
+    return step.new_ip != static_cast<uint16_t>(step.old_ip + instruction_size);
+}
+
+std::string_view get_flag_text(control_flags flags)
+{
+    const flag_text& text = flag_texts[static_cast<uint16_t>(flags) & (flag_combination_count - 1)];
+    return { text.chars.data(), text.length };
 }
 
 std::string get_flag_string(control_flags flags)
 {
-    std::string flag_string;
+    return std::string{ get_flag_text(flags) };
+}
 
-    uint16_t flag_value = 1;
-    while ((flag_value & 0xFFF) != 0)
+control_flags materialize_flags(lazy_flags& lazy, register_array& registers)
+{
+    if (lazy.pending)
     {
-        if (auto flag = control_flags{ flag_value }; flag_names.contains(flag) && has_all_flags(flags, flag))
-            flag_string += flag_names[flag];
-
-        flag_value <<= 1;
+        const control_flags flags = compute_flags(lazy.existing, lazy.operand, lazy.result, lazy.wide_value, lazy.is_addition);
+        registers[flags_index] = static_cast<uint16_t>(flags);
+        lazy.pending = false;
     }
 
-    return flag_string;
+    return control_flags{ registers[flags_index] };
 }
 
 simulation_step simulate_instruction(const instruction& inst, register_array& registers, memory_array& memory)
 {
+    lazy_flags lazy{};
+    simulation_step step = simulate_instruction(inst, registers, memory, lazy);
+    step.new_flags = materialize_flags(lazy, registers);
+
+    return step;
+}
+
+simulation_step simulate_instruction(const instruction& inst, register_array& registers, memory_array& memory, lazy_flags& lazy)
+{
+    PROFILE_ZONE("simulate_instruction");
+
+    if (reads_flags(inst.op))
+        materialize_flags(lazy, registers);
+
     auto source_matcher = overloaded
     {
         [&registers, &memory](const effective_address_expression& eae) -> uint16_t
@@ -209,6 +299,13 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
         .new_ip = static_cast<uint16_t>(registers[instruction_pointer_index] + inst.size)
     };
 
+    // at most one operand is in memory, and where it is decides the cost of its transfers
+    for (const instruction_operand& operand : inst.operands)
+    {
+        if (std::holds_alternative<direct_address>(operand) || std::holds_alternative<effective_address_expression>(operand))
+            step.memory_address = get_address(operand, registers);
+    }
+
     if (const register_access* reg_destination = std::get_if<register_access>(&destination_op))
     {
         step.destination = *reg_destination;
@@ -246,7 +343,15 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
                 const bool is_addition = (inst.op == operation_type::add);
                 const int32_t result = is_addition ? old_value_signed + operand : old_value_signed - operand;
 
-                step.new_flags = compute_flags(old_value_signed, operand, result, wide_value, is_addition);
+                lazy = lazy_flags
+                {
+                    .existing = old_value_signed,
+                    .operand = operand,
+                    .result = result,
+                    .wide_value = wide_value,
+                    .is_addition = is_addition,
+                    .pending = true
+                };
 
                 if (inst.op != operation_type::cmp)
                     step.new_value = static_cast<uint16_t>(result);
@@ -255,7 +360,7 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
             }
 
             default:
-                throw std::exception{ "Opcode does not support a register as the first operand." };
+                throw std::runtime_error{ "Opcode does not support a register as the first operand." };
         }
 
         // write to registers
@@ -371,7 +476,7 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
                         do_jump = registers[counter_register_index] == 0;
                         break;
                     default:
-                        throw std::exception{ "Unexpected loop-related opcode." };
+                        throw std::runtime_error{ "Unexpected loop-related opcode." };
                 }
                 break;
             }
@@ -383,7 +488,7 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
             }
 
             default:
-                throw std::exception{ "Opcode does not support an immediate as the first operand." };
+                throw std::runtime_error{ "Opcode does not support an immediate as the first operand." };
         }
 
         if (do_jump)
@@ -397,7 +502,7 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
         {
             case operation_type::mov:
             {
-                store_value(op_value, address, inst.flags, memory);
+                step.write = store_value(op_value, address, inst.flags, memory);
                 break;
             }
 
@@ -410,7 +515,7 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
 
                 const uint16_t new_value = existing_value + op_value;
                 
-                store_value(new_value, address, inst.flags, memory);
+                step.write = store_value(new_value, address, inst.flags, memory);
                 break;
             }
 
@@ -422,12 +527,12 @@ simulation_step simulate_instruction(const instruction& inst, register_array& re
             }
             
             default:
-                throw std::exception{ "Opcode does not support an address as the first operand." };
+                throw std::runtime_error{ "Opcode does not support an address as the first operand." };
         }
     }
     else if (!std::holds_alternative<std::monostate>(destination_op))
     {
-        throw std::exception{ "The instruction's first operand had an unexpected type." };
+        throw std::runtime_error{ "The instruction's first operand had an unexpected type." };
     }
 
     registers[instruction_pointer_index] = step.new_ip;
@@ -4,6 +4,7 @@
 #include <array>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 #include "flag_utils.hpp"
 #include "register_access.hpp"
@@ -26,6 +27,14 @@ enum class control_flags : uint16_t
 
 FLAG_OPERATIONS(control_flags);
 
+struct memory_write
+{
+    uint32_t address{};
+    uint32_t count{};
+    uint16_t value{};
+    uint16_t old_value{};
+};
+
 struct simulation_step
 {
     register_access destination{};
@@ -35,6 +44,19 @@ struct simulation_step
     control_flags new_flags{};
     uint16_t old_ip{};
     uint16_t new_ip{};
+    memory_write write{};
+    uint32_t memory_address{}; // of the memory operand, when there is one
+};
+
+// operands of the last flag-setting operation, kept so flags are only computed when something reads them
+struct lazy_flags
+{
+    int32_t existing{};
+    int32_t operand{};
+    int32_t result{};
+    bool wide_value{};
+    bool is_addition{};
+    bool pending{};
 };
 
 inline constexpr int counter_register_index = 2;
@@ -47,8 +69,19 @@ inline constexpr int memory_size = 1024 * 1024;
 using register_array = std::array<uint16_t, register_count>;
 using memory_array = std::array<uint8_t, memory_size>;
 
+// whether the step moved ip anywhere other than the next instruction; a jump to the next instruction looks like falling through
+bool is_jump_taken(const simulation_step& step, uint32_t instruction_size);
+
+std::string_view get_flag_text(control_flags flags);
+
 std::string get_flag_string(control_flags flags);
 
+control_flags materialize_flags(lazy_flags& lazy, register_array& registers);
+
 simulation_step simulate_instruction(const instruction& inst, register_array& registers, memory_array& memory);
 
+// records flag-setting operations in lazy instead of computing their flags, so new_flags in the step is only
+// current when lazy has nothing pending; call materialize_flags before reading the flags register
+simulation_step simulate_instruction(const instruction& inst, register_array& registers, memory_array& memory, lazy_flags& lazy);
+
 #endif
@@ -0,0 +1,309 @@
+﻿#include "static_recompiler.hpp"
+
+#include <array>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "control_flow.hpp"
+#include "flag_utils.hpp"
+#include "formatter.hpp"
+#include "instruction.hpp"
+#include "overloaded.hpp"
+#include "simulator.hpp"
+
+namespace
+{
+    using namespace std::string_view_literals;
+
+    bool is_memory(const instruction_operand& operand)
+    {
+        return std::holds_alternative<effective_address_expression>(operand) || std::holds_alternative<direct_address>(operand);
+    }
+
+    bool is_branch(operation_type op)
+    {
+        return op >= operation_type::je && op <= operation_type::jmp;
+    }
+
+    // the instructions simulate_instruction runs rather than rejects; the rest are left to it, so it throws the same errors
+    bool can_translate(const instruction& inst)
+    {
+        const instruction_operand& destination = inst.operands[0];
+        const instruction_operand& source = inst.operands[1];
+
+        if (std::holds_alternative<register_access>(destination))
+            return inst.op == operation_type::mov || inst.op == operation_type::add || inst.op == operation_type::sub || inst.op == operation_type::cmp;
+
+        if (is_memory(destination))
+        {
+            if (inst.op == operation_type::jmp)
+                return true;
+
+            const bool register_or_immediate = std::holds_alternative<register_access>(source) || std::holds_alternative<immediate>(source);
+            return register_or_immediate && (inst.op == operation_type::mov || inst.op == operation_type::add);
+        }
+
+        if (std::holds_alternative<immediate>(destination))
+            return is_branch(inst.op);
+
+        return inst.op == operation_type::nop;
+    }
+
+    // computed the way get_address in the simulator does, wrapping at 32 bits
+    std::string get_address_expression(const instruction_operand& operand)
+    {
+        if (const auto* da = std::get_if<direct_address>(&operand))
+            return std::format("uint32_t{{ {:#x} }}", da->address);
+
+        const auto& eae = std::get<effective_address_expression>(operand);
+        std::string expression = std::format("static_cast<uint32_t>(r[{}]", eae.term1.reg.index);
+
+        if (eae.displacement != 0)
+            std::format_to(std::back_inserter(expression), " {} {}", eae.displacement < 0 ? '-' : '+', eae.displacement < 0 ? -eae.displacement : eae.displacement);
+
+        if (eae.term2.has_value())
+            std::format_to(std::back_inserter(expression), " + r[{}]", eae.term2->reg.index);
+
+        return expression + ")";
+    }
+
+    // a source operand as a 16-bit value, with memory read a byte at a time and the byte register quirks of simulate_instruction
+    std::string get_source_expression(const instruction_operand& operand)
+    {
+        return std::visit(overloaded
+        {
+            [&operand](const effective_address_expression&) { return std::format("uint16_t{{ m[{}] }}", get_address_expression(operand)); },
+            [&operand](direct_address) { return std::format("uint16_t{{ m[{}] }}", get_address_expression(operand)); },
+            [](register_access reg)
+            {
+                if (reg.count == 2)
+                    return std::format("r[{}]", reg.index);
+
+                return reg.offset == 0 ? std::format("static_cast<uint16_t>((r[{}] & 0xFF00) >> 8)", reg.index) : std::format("static_cast<uint16_t>(r[{}] & 0x00FF)", reg.index);
+            },
+            [](immediate value) { return std::format("uint16_t{{ {:#06x} }}", static_cast<uint16_t>(value.value)); },
+            [](std::monostate) { return std::string{ "uint16_t{ 0 }" }; }
+        }, operand);
+    }
+
+    std::string_view get_condition_expression(operation_type op)
+    {
+        switch (op)
+        {
+            case operation_type::je: return "has_any_flag(f, control_flags::zero)"sv;
+            case operation_type::jne: return "!has_any_flag(f, control_flags::zero)"sv;
+            case operation_type::jl: return "has_any_flag(f, control_flags::sign) ^ has_any_flag(f, control_flags::overflow)"sv;
+            case operation_type::jnl: return "!(has_any_flag(f, control_flags::sign) ^ has_any_flag(f, control_flags::overflow))"sv;
+            case operation_type::jle: return "(has_any_flag(f, control_flags::sign) ^ has_any_flag(f, control_flags::overflow)) || has_any_flag(f, control_flags::zero)"sv;
+            case operation_type::jg: return "!(has_any_flag(f, control_flags::sign) ^ has_any_flag(f, control_flags::overflow)) || !has_any_flag(f, control_flags::zero)"sv;
+            case operation_type::jb: return "has_any_flag(f, control_flags::carry)"sv;
+            case operation_type::jnb: return "!has_any_flag(f, control_flags::carry)"sv;
+            case operation_type::jbe: return "has_any_flag(f, control_flags::zero | control_flags::carry)"sv;
+            case operation_type::ja: return "!has_any_flag(f, control_flags::zero | control_flags::carry)"sv;
+            case operation_type::jp: return "has_any_flag(f, control_flags::parity)"sv;
+            case operation_type::jnp: return "!has_any_flag(f, control_flags::parity)"sv;
+            case operation_type::jo: return "has_any_flag(f, control_flags::overflow)"sv;
+            case operation_type::jno: return "!has_any_flag(f, control_flags::overflow)"sv;
+            case operation_type::js: return "has_any_flag(f, control_flags::sign)"sv;
+            case operation_type::jns: return "!has_any_flag(f, control_flags::sign)"sv;
+            case operation_type::loopz: return "r[2] == 0 && has_any_flag(f, control_flags::zero)"sv;
+            case operation_type::loopnz: return "r[2] != 0 && !has_any_flag(f, control_flags::zero)"sv;
+            default: return "r[2] != 0"sv;
+        }
+    }
+
+    void append_register_operation(std::string& out, const instruction& inst, register_access destination)
+    {
+        const std::string source = get_source_expression(inst.operands[1]);
+        const bool high_byte = destination.count == 1 && destination.offset == 0;
+
+        if (inst.op == operation_type::mov)
+        {
+            if (destination.count == 2)
+                std::format_to(std::back_inserter(out), "        r[{0}] = {1};\n", destination.index, source);
+            else if (high_byte)
+                std::format_to(std::back_inserter(out), "        r[{0}] = static_cast<uint16_t>((r[{0}] & 0xFF) + ({1} << 8 & 0xFF00));\n", destination.index, source);
+            else
+                std::format_to(std::back_inserter(out), "        r[{0}] = static_cast<uint16_t>((r[{0}] & 0xFF00) + {1});\n", destination.index, source);
+
+            return;
+        }
+
+        const bool is_addition = inst.op == operation_type::add;
+
+        std::format_to(std::back_inserter(out), "        {{\n            const auto existing = static_cast<int16_t>(r[{}]);\n", destination.index);
+        std::format_to(std::back_inserter(out), "            const int32_t operand = static_cast<int16_t>({}){};\n", source, high_byte ? " << 8" : "");
+        std::format_to(std::back_inserter(out), "            const int32_t result = existing {} operand;\n", is_addition ? '+' : '-');
+        std::format_to(std::back_inserter(out), "            lazy = lazy_flags{{ .existing = existing, .operand = operand, .result = result, .wide_value = {}, .is_addition = {}, .pending = true }};\n",
+            destination.count == 2, is_addition);
+
+        if (inst.op != operation_type::cmp)
+            std::format_to(std::back_inserter(out), "            r[{}] = static_cast<uint16_t>(result);\n", destination.index);
+
+        out += "        }\n";
+    }
+
+    // stores leave the block as soon as they write to the code, so nothing runs from a translation of bytes that changed
+    void append_memory_operation(std::string& out, const instruction& inst, size_t executed_count)
+    {
+        const std::string source = get_source_expression(inst.operands[1]);
+        const bool wide = has_any_flag(inst.flags, instruction_flags::wide);
+
+        std::format_to(std::back_inserter(out), "        {{\n            const uint32_t address = {};\n", get_address_expression(inst.operands[0]));
+
+        if (inst.op == operation_type::mov)
+        {
+            std::format_to(std::back_inserter(out), "            const uint16_t value = {};\n", source);
+        }
+        else
+        {
+            out += "            uint16_t existing = m[address];\n";
+
+            if (wide)
+                out += "            existing += (m[address + 1] << 8) & 0xFF00;\n";
+
+            std::format_to(std::back_inserter(out), "            const auto value = static_cast<uint16_t>(existing + {});\n", source);
+        }
+
+        std::format_to(std::back_inserter(out), "\n            if (store_recompiled(sim, address, value, {}))\n            {{\n", wide);
+        std::format_to(std::back_inserter(out), "                sim.instruction_count += {};\n", executed_count);
+        std::format_to(std::back_inserter(out), "                r[{}] = {:#06x};\n", instruction_pointer_index, static_cast<uint16_t>(inst.address + inst.size));
+        out += "                return block_result::code_modified;\n            }\n        }\n";
+    }
+
+    // the branch that ends a block, leaving ip where it goes
+    void append_branch(std::string& out, const instruction& inst)
+    {
+        if (is_memory(inst.operands[0]))
+        {
+            std::format_to(std::back_inserter(out), "        const uint32_t address = {};\n", get_address_expression(inst.operands[0]));
+            std::format_to(std::back_inserter(out), "        r[{}] = static_cast<uint16_t>(m[address] + ((m[address + 1] << 8) & 0xFF00));\n", instruction_pointer_index);
+            return;
+        }
+
+        const auto fall_through = static_cast<uint16_t>(inst.address + inst.size);
+        const auto target = static_cast<uint16_t>(fall_through + std::get<immediate>(inst.operands[0]).value);
+
+        switch (inst.op)
+        {
+            case operation_type::jmp:
+                std::format_to(std::back_inserter(out), "        r[{}] = {:#06x};\n", instruction_pointer_index, target);
+                return;
+
+            case operation_type::jcxz:
+                std::format_to(std::back_inserter(out), "        r[{}] = r[2] == 0 ? {:#06x} : {:#06x};\n", instruction_pointer_index, target, fall_through);
+                return;
+
+            case operation_type::loop:
+                break;
+
+            default:
+                out += "        const control_flags f = materialize_flags(lazy, r);\n";
+                break;
+        }
+
+        if (inst.op == operation_type::loop || inst.op == operation_type::loopz || inst.op == operation_type::loopnz)
+            out += "        r[2] = static_cast<uint16_t>(r[2] - 1);\n";
+
+        std::format_to(std::back_inserter(out), "        r[{}] = ({}) ? {:#06x} : {:#06x};\n", instruction_pointer_index, get_condition_expression(inst.op), target, fall_through);
+    }
+
+    std::string get_block_function_name(const basic_block& block)
+    {
+        return std::format("block_{:04x}", block.start);
+    }
+
+    // returns false without appending anything when the block starts with an instruction that cannot be translated
+    bool append_block(std::string& out, const basic_block& block)
+    {
+        if (block.instructions.empty() || !can_translate(block.instructions.front()))
+            return false;
+
+        std::format_to(std::back_inserter(out), "    block_result {}(machine& sim)\n    {{\n", get_block_function_name(block));
+        out += "        [[maybe_unused]] register_array& r = sim.registers;\n";
+        out += "        [[maybe_unused]] memory_array& m = *sim.memory;\n";
+        out += "        [[maybe_unused]] lazy_flags& lazy = sim.lazy;\n";
+
+        std::array<char, line_buffer_size> instruction_text{};
+
+        // ip where the translated code stops, which is past the block unless the interpreter has to take over partway
+        auto exit_ip = static_cast<uint16_t>(block.end);
+        size_t executed_count = 0;
+
+        for (const instruction& inst : block.instructions)
+        {
+            if (!can_translate(inst))
+            {
+                exit_ip = static_cast<uint16_t>(inst.address);
+                break;
+            }
+
+            const std::string_view text{ instruction_text.data(), format_instruction(instruction_text.data(), inst) };
+            std::format_to(std::back_inserter(out), "\n        // {:#06x}: {}\n", inst.address, text);
+            ++executed_count;
+
+            if (is_branch(inst.op))
+            {
+                std::format_to(std::back_inserter(out), "        sim.instruction_count += {};\n", executed_count);
+                append_branch(out, inst);
+                out += "        return block_result::ran;\n    }\n\n";
+                return true;
+            }
+
+            if (const auto* destination = std::get_if<register_access>(&inst.operands[0]))
+                append_register_operation(out, inst, *destination);
+            else if (is_memory(inst.operands[0]))
+                append_memory_operation(out, inst, executed_count);
+        }
+
+        std::format_to(std::back_inserter(out), "\n        sim.instruction_count += {};\n", executed_count);
+        std::format_to(std::back_inserter(out), "        r[{}] = {:#06x};\n", instruction_pointer_index, exit_ip);
+        out += "        return block_result::ran;\n    }\n\n";
+
+        return true;
+    }
+}
+
+program_translation translate_program(std::span<uint8_t> code, std::string_view program_name)
+{
+    const control_flow_graph graph = build_control_flow_graph(code);
+    program_translation translation{ .source = {}, .block_count = graph.blocks.size() };
+
+    std::string& out = translation.source;
+    std::format_to(std::back_inserter(out), "// {} translated by sim86 -recompile; build it against sim86_core, e.g. with -DSIM86_RECOMPILED_PROGRAM\n\n", program_name);
+    out += "#include <array>\n#include <cstdint>\n\n#include \"machine.hpp\"\n#include \"recompiled_runtime.hpp\"\n#include \"simulator.hpp\"\n\nnamespace\n{\n";
+
+    // the program itself is still loaded, for the interpreter and for any data it reads from its own code
+    std::format_to(std::back_inserter(out), "    constexpr std::array<uint8_t, {}> program =\n    {{", code.size());
+
+    for (size_t i = 0; i < code.size(); ++i)
+        std::format_to(std::back_inserter(out), "{}{:#04x}{}", i % 16 == 0 ? "\n        " : " ", code[i], i + 1 < code.size() ? "," : "");
+
+    out += "\n    };\n\n";
+
+    std::vector<const basic_block*> translated;
+
+    for (const basic_block& block : graph.blocks)
+    {
+        if (append_block(out, block))
+            translated.push_back(&block);
+    }
+
+    translation.translated_block_count = translated.size();
+
+    out += "    block_result dispatch_block(machine& sim)\n    {\n";
+    std::format_to(std::back_inserter(out), "        switch (sim.registers[{}])\n        {{\n", instruction_pointer_index);
+
+    for (const basic_block* block : translated)
+        std::format_to(std::back_inserter(out), "            case {:#06x}: return {}(sim);\n", block->start, get_block_function_name(*block));
+
+    out += "            default: return block_result::no_block;\n        }\n    }\n}\n\n";
+
+    std::format_to(std::back_inserter(out), "int main()\n{{\n    return compare_with_interpreter(\"{}\", program, &dispatch_block);\n}}\n", program_name);
+
+    return translation;
+}
@@ -0,0 +1,21 @@
+﻿#ifndef WS_STATICRECOMPILER_HPP
+#define WS_STATICRECOMPILER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+struct program_translation
+{
+    std::string source;
+    size_t block_count{};
+    size_t translated_block_count{}; // blocks that start with an instruction only the interpreter runs are left out
+};
+
+// C++ for a program with one function per basic block, working on the same registers, memory and lazy flags as
+// simulate_instruction; built against sim86_core, it runs the program both ways and reports the speedup
+program_translation translate_program(std::span<uint8_t> code, std::string_view program_name);
+
+#endif
@@ -0,0 +1,632 @@
+﻿#include "threaded_interpreter.hpp"
+
+#include <bit>
+#include <limits>
+#include <variant>
+
+#include "decode_cache.hpp"
+#include "flag_utils.hpp"
+#include "instruction.hpp"
+
+namespace
+{
+    // every handler below repeats what simulate_instruction does for one shape of instruction, quirks included
+    enum class operand_kind : uint8_t
+    {
+        none,
+        word_register,
+        byte_register_offset_zero,
+        byte_register_offset_one,
+        memory,
+        immediate
+    };
+
+    simulation_step begin_step(const threaded_op& op, const register_array& registers)
+    {
+        return simulation_step
+        {
+            .old_flags = control_flags{ registers[flags_index] },
+            .new_flags = control_flags{ registers[flags_index] },
+            .old_ip = registers[instruction_pointer_index],
+            .new_ip = static_cast<uint16_t>(registers[instruction_pointer_index] + op.size)
+        };
+    }
+
+    uint32_t get_operand_address(const threaded_op& op, const register_array& registers)
+    {
+        auto address = static_cast<uint32_t>(op.displacement);
+
+        if (op.address_terms > 0)
+            address += registers[op.address_base];
+
+        if (op.address_terms > 1)
+            address += registers[op.address_index];
+
+        return address;
+    }
+
+    template <operand_kind kind>
+    uint16_t read_register(const register_array& registers, register_access reg)
+    {
+        if constexpr (kind == operand_kind::byte_register_offset_zero)
+            return (registers[reg.index] & 0xFF00) >> 8;
+        else if constexpr (kind == operand_kind::byte_register_offset_one)
+            return registers[reg.index] & 0x00FF;
+        else
+            return registers[reg.index];
+    }
+
+    // memory sources only ever read one byte
+    template <operand_kind source_kind>
+    uint16_t read_source(const threaded_op& op, const threaded_context& context, simulation_step& step)
+    {
+        if constexpr (source_kind == operand_kind::memory)
+        {
+            step.memory_address = get_operand_address(op, context.registers);
+            return context.memory[step.memory_address];
+        }
+        else if constexpr (source_kind == operand_kind::immediate)
+        {
+            return op.immediate;
+        }
+        else
+        {
+            return read_register<source_kind>(context.registers, op.source);
+        }
+    }
+
+    template <bool wide>
+    memory_write store_value(uint16_t value, uint32_t address, memory_array& memory)
+    {
+        const uint16_t old_low = memory[address];
+        memory[address] = value & 0xFF;
+
+        if constexpr (wide)
+        {
+            const uint16_t old_high = memory[address + 1];
+            memory[address + 1] = (value >> 8) & 0xFF;
+            return { .address = address, .count = 2, .value = value, .old_value = static_cast<uint16_t>(old_low | (old_high << 8)) };
+        }
+        else
+        {
+            return { .address = address, .count = 1, .value = static_cast<uint16_t>(value & 0xFF), .old_value = old_low };
+        }
+    }
+
+    template <operation_type op_type, operand_kind destination_kind, operand_kind source_kind>
+    simulation_step run_register_destination(const threaded_op& op, threaded_context& context)
+    {
+        register_array& registers = context.registers;
+        simulation_step step = begin_step(op, registers);
+        const uint16_t op_value = read_source<source_kind>(op, context, step);
+
+        step.destination = op.destination;
+        step.old_value = registers[op.destination.index];
+        step.new_value = step.old_value;
+
+        if constexpr (op_type == operation_type::mov)
+        {
+            if constexpr (destination_kind == operand_kind::byte_register_offset_zero)
+                step.new_value = (step.old_value & 0xFF) + (op_value << 8 & 0xFF00);
+            else if constexpr (destination_kind == operand_kind::byte_register_offset_one)
+                step.new_value = (step.old_value & 0xFF00) + op_value;
+            else
+                step.new_value = op_value;
+        }
+        else
+        {
+            const auto old_value_signed = static_cast<int16_t>(step.old_value);
+            const auto op_value_signed = static_cast<int16_t>(op_value);
+
+            constexpr bool shifted = (destination_kind == operand_kind::byte_register_offset_zero);
+            const int32_t operand = shifted ? op_value_signed << 8 : op_value_signed;
+
+            constexpr bool is_addition = (op_type == operation_type::add);
+            const int32_t result = is_addition ? old_value_signed + operand : old_value_signed - operand;
+
+            context.lazy = lazy_flags
+            {
+                .existing = old_value_signed,
+                .operand = operand,
+                .result = result,
+                .wide_value = destination_kind == operand_kind::word_register,
+                .is_addition = is_addition,
+                .pending = true
+            };
+
+            if constexpr (op_type != operation_type::cmp)
+                step.new_value = static_cast<uint16_t>(result);
+        }
+
+        registers[op.destination.index] = step.new_value;
+        registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    template <operation_type op_type, operand_kind source_kind, bool wide>
+    simulation_step run_memory_destination(const threaded_op& op, threaded_context& context)
+    {
+        register_array& registers = context.registers;
+        memory_array& memory = context.memory;
+
+        simulation_step step = begin_step(op, registers);
+        const uint16_t op_value = read_source<source_kind>(op, context, step);
+
+        const uint32_t address = get_operand_address(op, registers);
+        step.memory_address = address;
+
+        if constexpr (op_type == operation_type::mov)
+        {
+            step.write = store_value<wide>(op_value, address, memory);
+        }
+        else
+        {
+            uint16_t existing_value = memory[address];
+
+            if constexpr (wide)
+                existing_value += (memory[address + 1] << 8) & 0xFF00;
+
+            step.write = store_value<wide>(static_cast<uint16_t>(existing_value + op_value), address, memory);
+        }
+
+        registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    // reads flags that have already been computed
+    struct computed_flags
+    {
+        control_flags flags{};
+
+        bool carry() const { return has_any_flag(flags, control_flags::carry); }
+        bool parity() const { return has_any_flag(flags, control_flags::parity); }
+        bool zero() const { return has_any_flag(flags, control_flags::zero); }
+        bool sign() const { return has_any_flag(flags, control_flags::sign); }
+        bool overflow() const { return has_any_flag(flags, control_flags::overflow); }
+    };
+
+    // works out single flags of the pending operation the same way compute_flags does, without computing the others
+    struct pending_flags
+    {
+        const lazy_flags& lazy;
+
+        bool carry() const
+        {
+            const int32_t max_unsigned = lazy.wide_value ? std::numeric_limits<uint16_t>::max() : std::numeric_limits<uint8_t>::max();
+            const auto existing_unsigned = static_cast<uint16_t>(lazy.existing);
+            const auto operand_unsigned = static_cast<uint16_t>(lazy.operand);
+            const int32_t result_unsigned = lazy.is_addition ? (existing_unsigned + operand_unsigned) : (existing_unsigned - operand_unsigned);
+
+            return result_unsigned > max_unsigned || result_unsigned < 0;
+        }
+
+        bool parity() const { return (std::popcount(static_cast<uint8_t>(lazy.result & 0xFF)) & 1) == 0; }
+        bool zero() const { return lazy.result == 0; }
+        bool sign() const { return (lazy.result & 0x8000) != 0; }
+
+        bool overflow() const
+        {
+            if (lazy.wide_value)
+                return lazy.result > std::numeric_limits<int16_t>::max() || lazy.result < std::numeric_limits<int16_t>::min();
+
+            return lazy.result > std::numeric_limits<int8_t>::max() || lazy.result < std::numeric_limits<int8_t>::min();
+        }
+    };
+
+    template <operation_type op_type, typename flag_reader>
+    bool is_condition_met(const flag_reader& flags)
+    {
+        if constexpr (op_type == operation_type::je) return flags.zero();
+        else if constexpr (op_type == operation_type::jne) return !flags.zero();
+        else if constexpr (op_type == operation_type::jl) return flags.sign() ^ flags.overflow();
+        else if constexpr (op_type == operation_type::jnl) return !(flags.sign() ^ flags.overflow());
+        else if constexpr (op_type == operation_type::jle) return (flags.sign() ^ flags.overflow()) || flags.zero();
+        else if constexpr (op_type == operation_type::jg) return !(flags.sign() ^ flags.overflow()) || !flags.zero();
+        else if constexpr (op_type == operation_type::jb) return flags.carry();
+        else if constexpr (op_type == operation_type::jnb) return !flags.carry();
+        else if constexpr (op_type == operation_type::jbe) return flags.zero() || flags.carry();
+        else if constexpr (op_type == operation_type::ja) return !(flags.zero() || flags.carry());
+        else if constexpr (op_type == operation_type::jp) return flags.parity();
+        else if constexpr (op_type == operation_type::jnp) return !flags.parity();
+        else if constexpr (op_type == operation_type::jo) return flags.overflow();
+        else if constexpr (op_type == operation_type::jno) return !flags.overflow();
+        else if constexpr (op_type == operation_type::js) return flags.sign();
+        else return !flags.sign();
+    }
+
+    // decrements cx for the loops, and says whether to jump
+    template <operation_type op_type, typename flag_reader>
+    bool is_counter_condition_met(register_array& registers, const flag_reader& flags)
+    {
+        uint16_t& counter = registers[counter_register_index];
+
+        if constexpr (op_type == operation_type::jcxz)
+            return counter == 0;
+
+        --counter;
+
+        if constexpr (op_type == operation_type::loopz)
+            return counter == 0 && flags.zero();
+        else if constexpr (op_type == operation_type::loopnz)
+            return counter != 0 && !flags.zero();
+        else
+            return counter != 0;
+    }
+
+    template <operation_type op_type>
+    constexpr bool is_counter_jump()
+    {
+        return op_type == operation_type::loop || op_type == operation_type::loopz || op_type == operation_type::loopnz || op_type == operation_type::jcxz;
+    }
+
+    template <operation_type op_type>
+    simulation_step run_conditional_jump(const threaded_op& op, threaded_context& context)
+    {
+        register_array& registers = context.registers;
+        materialize_flags(context.lazy, registers);
+
+        simulation_step step = begin_step(op, registers);
+        step.destination = { .index = instruction_pointer_index, .offset = 0, .count = 2 };
+
+        if (is_condition_met<op_type>(computed_flags{ step.old_flags }))
+            step.new_ip += op.immediate;
+
+        registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    template <operation_type op_type>
+    simulation_step run_counter_jump(const threaded_op& op, threaded_context& context)
+    {
+        register_array& registers = context.registers;
+
+        if constexpr (op_type == operation_type::loopz || op_type == operation_type::loopnz)
+            materialize_flags(context.lazy, registers);
+
+        simulation_step step = begin_step(op, registers);
+        step.destination = { .index = counter_register_index, .offset = 0, .count = 2 };
+        step.old_value = registers[counter_register_index];
+
+        if (is_counter_condition_met<op_type>(registers, computed_flags{ step.old_flags }))
+            step.new_ip += op.immediate;
+
+        step.new_value = registers[counter_register_index];
+        registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    // the flag-setting instruction and the branch after it in one dispatch; the flags stay pending, and only the ones
+    // the branch tests are worked out, so the step describes the pair as a whole rather than either instruction
+    template <operation_type op_type, operand_kind source_kind, operation_type branch_type>
+    simulation_step run_fused_branch(const threaded_op& op, threaded_context& context)
+    {
+        register_array& registers = context.registers;
+        simulation_step step = run_register_destination<op_type, operand_kind::word_register, source_kind>(op, context);
+
+        bool do_jump{};
+
+        if constexpr (is_counter_jump<branch_type>())
+            do_jump = is_counter_condition_met<branch_type>(registers, pending_flags{ context.lazy });
+        else
+            do_jump = is_condition_met<branch_type>(pending_flags{ context.lazy });
+
+        step.new_ip += op.branch_size;
+
+        if (do_jump)
+            step.new_ip += op.branch_displacement;
+
+        registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    simulation_step run_relative_jump(const threaded_op& op, threaded_context& context)
+    {
+        simulation_step step = begin_step(op, context.registers);
+        step.destination = { .index = instruction_pointer_index, .offset = 0, .count = 2 };
+        step.new_ip += op.immediate;
+
+        context.registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    simulation_step run_indirect_jump(const threaded_op& op, threaded_context& context)
+    {
+        simulation_step step = begin_step(op, context.registers);
+
+        const uint32_t address = get_operand_address(op, context.registers);
+        step.memory_address = address;
+        step.new_ip = static_cast<uint16_t>(context.memory[address] + ((context.memory[address + 1] << 8) & 0xFF00));
+
+        context.registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    simulation_step run_nop(const threaded_op& op, threaded_context& context)
+    {
+        const simulation_step step = begin_step(op, context.registers);
+        context.registers[instruction_pointer_index] = step.new_ip;
+
+        return step;
+    }
+
+    // anything without a handler of its own, including everything simulate_instruction rejects
+    simulation_step run_reference(const threaded_op& op, threaded_context& context)
+    {
+        return simulate_instruction(context.cache.instructions[op.entry_index], context.registers, context.memory, context.lazy);
+    }
+
+    operand_kind get_operand_kind(const instruction_operand& operand)
+    {
+        if (const auto* reg = std::get_if<register_access>(&operand))
+        {
+            if (reg->count == 2)
+                return operand_kind::word_register;
+
+            return reg->offset == 0 ? operand_kind::byte_register_offset_zero : operand_kind::byte_register_offset_one;
+        }
+
+        if (std::holds_alternative<effective_address_expression>(operand) || std::holds_alternative<direct_address>(operand))
+            return operand_kind::memory;
+
+        if (std::holds_alternative<immediate>(operand))
+            return operand_kind::immediate;
+
+        return operand_kind::none;
+    }
+
+    template <operation_type op_type, operand_kind destination_kind>
+    threaded_handler select_register_source(operand_kind source_kind)
+    {
+        switch (source_kind)
+        {
+            case operand_kind::word_register: return &run_register_destination<op_type, destination_kind, operand_kind::word_register>;
+            case operand_kind::byte_register_offset_zero: return &run_register_destination<op_type, destination_kind, operand_kind::byte_register_offset_zero>;
+            case operand_kind::byte_register_offset_one: return &run_register_destination<op_type, destination_kind, operand_kind::byte_register_offset_one>;
+            case operand_kind::memory: return &run_register_destination<op_type, destination_kind, operand_kind::memory>;
+            case operand_kind::immediate: return &run_register_destination<op_type, destination_kind, operand_kind::immediate>;
+            default: return nullptr;
+        }
+    }
+
+    template <operation_type op_type>
+    threaded_handler select_register_destination(operand_kind destination_kind, operand_kind source_kind)
+    {
+        switch (destination_kind)
+        {
+            case operand_kind::word_register: return select_register_source<op_type, operand_kind::word_register>(source_kind);
+            case operand_kind::byte_register_offset_zero: return select_register_source<op_type, operand_kind::byte_register_offset_zero>(source_kind);
+            case operand_kind::byte_register_offset_one: return select_register_source<op_type, operand_kind::byte_register_offset_one>(source_kind);
+            default: return nullptr;
+        }
+    }
+
+    template <operation_type op_type, bool wide>
+    threaded_handler select_memory_source(operand_kind source_kind)
+    {
+        switch (source_kind)
+        {
+            case operand_kind::word_register: return &run_memory_destination<op_type, operand_kind::word_register, wide>;
+            case operand_kind::byte_register_offset_zero: return &run_memory_destination<op_type, operand_kind::byte_register_offset_zero, wide>;
+            case operand_kind::byte_register_offset_one: return &run_memory_destination<op_type, operand_kind::byte_register_offset_one, wide>;
+            case operand_kind::immediate: return &run_memory_destination<op_type, operand_kind::immediate, wide>;
+            default: return nullptr;
+        }
+    }
+
+    template <operation_type op_type>
+    threaded_handler select_memory_destination(bool wide, operand_kind source_kind)
+    {
+        return wide ? select_memory_source<op_type, true>(source_kind) : select_memory_source<op_type, false>(source_kind);
+    }
+
+    threaded_handler select_handler(const instruction& inst)
+    {
+        const operand_kind destination_kind = get_operand_kind(inst.operands[0]);
+        const operand_kind source_kind = get_operand_kind(inst.operands[1]);
+        const bool wide = has_any_flag(inst.flags, instruction_flags::wide);
+
+        switch (destination_kind)
+        {
+            case operand_kind::word_register:
+            case operand_kind::byte_register_offset_zero:
+            case operand_kind::byte_register_offset_one:
+            {
+                switch (inst.op)
+                {
+                    case operation_type::mov: return select_register_destination<operation_type::mov>(destination_kind, source_kind);
+                    case operation_type::add: return select_register_destination<operation_type::add>(destination_kind, source_kind);
+                    case operation_type::sub: return select_register_destination<operation_type::sub>(destination_kind, source_kind);
+                    case operation_type::cmp: return select_register_destination<operation_type::cmp>(destination_kind, source_kind);
+                    default: return nullptr;
+                }
+            }
+
+            case operand_kind::memory:
+            {
+                switch (inst.op)
+                {
+                    case operation_type::mov: return select_memory_destination<operation_type::mov>(wide, source_kind);
+                    case operation_type::add: return select_memory_destination<operation_type::add>(wide, source_kind);
+                    case operation_type::jmp: return &run_indirect_jump;
+                    default: return nullptr;
+                }
+            }
+
+            case operand_kind::immediate:
+            {
+                switch (inst.op)
+                {
+                    case operation_type::je: return &run_conditional_jump<operation_type::je>;
+                    case operation_type::jl: return &run_conditional_jump<operation_type::jl>;
+                    case operation_type::jle: return &run_conditional_jump<operation_type::jle>;
+                    case operation_type::jb: return &run_conditional_jump<operation_type::jb>;
+                    case operation_type::jbe: return &run_conditional_jump<operation_type::jbe>;
+                    case operation_type::jp: return &run_conditional_jump<operation_type::jp>;
+                    case operation_type::jo: return &run_conditional_jump<operation_type::jo>;
+                    case operation_type::js: return &run_conditional_jump<operation_type::js>;
+                    case operation_type::jne: return &run_conditional_jump<operation_type::jne>;
+                    case operation_type::jnl: return &run_conditional_jump<operation_type::jnl>;
+                    case operation_type::jg: return &run_conditional_jump<operation_type::jg>;
+                    case operation_type::jnb: return &run_conditional_jump<operation_type::jnb>;
+                    case operation_type::ja: return &run_conditional_jump<operation_type::ja>;
+                    case operation_type::jnp: return &run_conditional_jump<operation_type::jnp>;
+                    case operation_type::jno: return &run_conditional_jump<operation_type::jno>;
+                    case operation_type::jns: return &run_conditional_jump<operation_type::jns>;
+                    case operation_type::loop: return &run_counter_jump<operation_type::loop>;
+                    case operation_type::loopz: return &run_counter_jump<operation_type::loopz>;
+                    case operation_type::loopnz: return &run_counter_jump<operation_type::loopnz>;
+                    case operation_type::jcxz: return &run_counter_jump<operation_type::jcxz>;
+                    case operation_type::jmp: return &run_relative_jump;
+                    default: return nullptr;
+                }
+            }
+
+            case operand_kind::none:
+                return inst.op == operation_type::nop ? &run_nop : nullptr;
+
+            default:
+                return nullptr;
+        }
+    }
+
+    template <operation_type op_type, operand_kind source_kind>
+    threaded_handler select_fused_branch(operation_type branch_type)
+    {
+        switch (branch_type)
+        {
+            case operation_type::je: return &run_fused_branch<op_type, source_kind, operation_type::je>;
+            case operation_type::jl: return &run_fused_branch<op_type, source_kind, operation_type::jl>;
+            case operation_type::jle: return &run_fused_branch<op_type, source_kind, operation_type::jle>;
+            case operation_type::jb: return &run_fused_branch<op_type, source_kind, operation_type::jb>;
+            case operation_type::jbe: return &run_fused_branch<op_type, source_kind, operation_type::jbe>;
+            case operation_type::jp: return &run_fused_branch<op_type, source_kind, operation_type::jp>;
+            case operation_type::jo: return &run_fused_branch<op_type, source_kind, operation_type::jo>;
+            case operation_type::js: return &run_fused_branch<op_type, source_kind, operation_type::js>;
+            case operation_type::jne: return &run_fused_branch<op_type, source_kind, operation_type::jne>;
+            case operation_type::jnl: return &run_fused_branch<op_type, source_kind, operation_type::jnl>;
+            case operation_type::jg: return &run_fused_branch<op_type, source_kind, operation_type::jg>;
+            case operation_type::jnb: return &run_fused_branch<op_type, source_kind, operation_type::jnb>;
+            case operation_type::ja: return &run_fused_branch<op_type, source_kind, operation_type::ja>;
+            case operation_type::jnp: return &run_fused_branch<op_type, source_kind, operation_type::jnp>;
+            case operation_type::jno: return &run_fused_branch<op_type, source_kind, operation_type::jno>;
+            case operation_type::jns: return &run_fused_branch<op_type, source_kind, operation_type::jns>;
+            case operation_type::loop: return &run_fused_branch<op_type, source_kind, operation_type::loop>;
+            case operation_type::loopz: return &run_fused_branch<op_type, source_kind, operation_type::loopz>;
+            case operation_type::loopnz: return &run_fused_branch<op_type, source_kind, operation_type::loopnz>;
+            case operation_type::jcxz: return &run_fused_branch<op_type, source_kind, operation_type::jcxz>;
+            default: return nullptr;
+        }
+    }
+
+    template <operation_type op_type>
+    threaded_handler select_fused_source(operand_kind source_kind, operation_type branch_type)
+    {
+        switch (source_kind)
+        {
+            case operand_kind::word_register: return select_fused_branch<op_type, operand_kind::word_register>(branch_type);
+            case operand_kind::immediate: return select_fused_branch<op_type, operand_kind::immediate>(branch_type);
+            default: return nullptr;
+        }
+    }
+
+    threaded_handler select_fused_handler(const instruction& first, const instruction& branch)
+    {
+        if (!can_start_fused_pair(first) || !std::holds_alternative<immediate>(branch.operands[0]))
+            return nullptr;
+
+        const operand_kind source_kind = get_operand_kind(first.operands[1]);
+
+        switch (first.op)
+        {
+            case operation_type::add: return select_fused_source<operation_type::add>(source_kind, branch.op);
+            case operation_type::sub: return select_fused_source<operation_type::sub>(source_kind, branch.op);
+            case operation_type::cmp: return select_fused_source<operation_type::cmp>(source_kind, branch.op);
+            default: return nullptr;
+        }
+    }
+
+    // fills in the address fields from whichever operand is in memory
+    void bind_address(const instruction_operand& operand, threaded_op& op)
+    {
+        if (const auto* eae = std::get_if<effective_address_expression>(&operand))
+        {
+            op.displacement = eae->displacement;
+            op.address_base = static_cast<uint8_t>(eae->term1.reg.index);
+            op.address_terms = 1;
+
+            if (eae->term2.has_value())
+            {
+                op.address_index = static_cast<uint8_t>(eae->term2->reg.index);
+                op.address_terms = 2;
+            }
+        }
+        else if (const auto* da = std::get_if<direct_address>(&operand))
+        {
+            op.displacement = static_cast<int32_t>(da->address);
+        }
+    }
+}
+
+threaded_op bind_instruction(const instruction& inst, uint32_t entry_index)
+{
+    threaded_op op
+    {
+        .handler = select_handler(inst),
+        .entry_index = entry_index,
+        .size = static_cast<uint16_t>(inst.size)
+    };
+
+    if (op.handler == nullptr)
+    {
+        op.handler = &run_reference;
+        return op;
+    }
+
+    if (const auto* reg = std::get_if<register_access>(&inst.operands[0]))
+        op.destination = *reg;
+
+    if (const auto* reg = std::get_if<register_access>(&inst.operands[1]))
+        op.source = *reg;
+
+    for (const instruction_operand& operand : inst.operands)
+    {
+        if (const auto* value = std::get_if<immediate>(&operand))
+            op.immediate = static_cast<uint16_t>(value->value);
+        else
+            bind_address(operand, op);
+    }
+
+    return op;
+}
+
+bool can_start_fused_pair(const instruction& first)
+{
+    const bool sets_flags = first.op == operation_type::add || first.op == operation_type::sub || first.op == operation_type::cmp;
+    const operand_kind source_kind = get_operand_kind(first.operands[1]);
+
+    return sets_flags && get_operand_kind(first.operands[0]) == operand_kind::word_register
+        && (source_kind == operand_kind::word_register || source_kind == operand_kind::immediate);
+}
+
+threaded_op bind_fused_pair(const instruction& first, const instruction& branch, uint32_t entry_index)
+{
+    const threaded_handler handler = select_fused_handler(first, branch);
+
+    if (handler == nullptr)
+        return {};
+
+    threaded_op op = bind_instruction(first, entry_index);
+    op.handler = handler;
+    op.branch_size = static_cast<uint16_t>(branch.size);
+    op.branch_displacement = static_cast<uint16_t>(std::get<immediate>(branch.operands[0]).value);
+    op.instruction_count = 2;
+
+    return op;
+}
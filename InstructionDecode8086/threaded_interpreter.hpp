@@ -0,0 +1,57 @@
+﻿#ifndef WS_THREADEDINTERPRETER_HPP
+#define WS_THREADEDINTERPRETER_HPP
+
+#include <cstdint>
+
+#include "register_access.hpp"
+#include "simulator.hpp"
+
+struct decode_cache;
+struct instruction;
+struct threaded_op;
+
+// what a handler works on; the cache is only needed to hand unusual instructions back to simulate_instruction
+struct threaded_context
+{
+    register_array& registers;
+    memory_array& memory;
+    lazy_flags& lazy;
+    const decode_cache& cache;
+};
+
+using threaded_handler = simulation_step (*)(const threaded_op& op, threaded_context& context);
+
+// a decoded instruction bound to a handler specialized for its operation and operand kinds, with its operands resolved
+struct threaded_op
+{
+    threaded_handler handler{};
+    uint32_t entry_index{}; // of the decode cache entry it was bound from
+    uint16_t size{};
+    uint16_t immediate{};   // source value, or jump displacement
+    register_access destination{};
+    register_access source{};
+    int32_t displacement{}; // of a memory operand, or its whole address when it is direct
+    uint8_t address_base{};
+    uint8_t address_index{};
+    uint8_t address_terms{}; // registers added to the displacement: 0, 1 or 2
+    uint8_t instruction_count{ 1 }; // 2 for a fused pair
+    uint16_t branch_size{};         // of the branch that ends a fused pair
+    uint16_t branch_displacement{};
+};
+
+threaded_op bind_instruction(const instruction& inst, uint32_t entry_index);
+
+// whether the instruction is an add, sub or cmp on a word register that a branch after it can be fused with
+bool can_start_fused_pair(const instruction& first);
+
+// a flag-setting instruction and the conditional jump or loop that follows it bound to one handler, which only works out
+// the flags the branch tests; returns an op without a handler when the pair cannot be fused
+threaded_op bind_fused_pair(const instruction& first, const instruction& branch, uint32_t entry_index);
+
+// records flag-setting operations in lazy exactly like the lazy overload of simulate_instruction
+inline simulation_step execute_threaded(const threaded_op& op, threaded_context& context)
+{
+    return op.handler(op, context);
+}
+
+#endif
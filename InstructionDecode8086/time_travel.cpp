@@ -0,0 +1,130 @@
+﻿#include "time_travel.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    void write_memory(memory_array& memory, const memory_write& write, uint16_t value)
+    {
+        memory[write.address] = value & 0xFF;
+
+        if (write.count > 1)
+            memory[write.address + 1] = (value >> 8) & 0xFF;
+    }
+
+    void apply_step(const simulation_step& step, register_array& registers, memory_array& memory)
+    {
+        if (step.destination.count != 0)
+            registers[step.destination.index] = step.new_value;
+
+        registers[instruction_pointer_index] = step.new_ip;
+        registers[flags_index] = static_cast<uint16_t>(step.new_flags);
+
+        if (step.write.count != 0)
+            write_memory(memory, step.write, step.write.value);
+    }
+
+    void revert_step(const simulation_step& step, register_array& registers, memory_array& memory)
+    {
+        if (step.write.count != 0)
+            write_memory(memory, step.write, step.write.old_value);
+
+        if (step.destination.count != 0)
+            registers[step.destination.index] = step.old_value;
+
+        registers[instruction_pointer_index] = step.old_ip;
+        registers[flags_index] = static_cast<uint16_t>(step.old_flags);
+    }
+
+    machine_checkpoint take_checkpoint(const register_array& registers, const memory_array& memory)
+    {
+        return machine_checkpoint
+        {
+            .registers = registers,
+            .memory = std::vector<uint8_t>(memory.begin(), memory.end())
+        };
+    }
+}
+
+time_travel_log start_time_travel(uint64_t checkpoint_interval, const register_array& registers, const memory_array& memory)
+{
+    if (checkpoint_interval == 0)
+        throw std::runtime_error{ "Checkpoint interval must be at least one step." };
+
+    time_travel_log log
+    {
+        .checkpoint_interval = checkpoint_interval,
+        .position = 0,
+        .steps = {},
+        .checkpoints = {}
+    };
+
+    log.checkpoints.push_back(take_checkpoint(registers, memory));
+
+    return log;
+}
+
+void record_step(time_travel_log& log, const simulation_step& step, const register_array& registers, const memory_array& memory)
+{
+    // executing after going back replaces the old future
+    if (log.position < log.steps.size())
+    {
+        log.steps.resize(log.position);
+        log.checkpoints.resize(log.position / log.checkpoint_interval + 1);
+    }
+
+    log.steps.push_back(step);
+    ++log.position;
+
+    if (log.position % log.checkpoint_interval == 0)
+        log.checkpoints.push_back(take_checkpoint(registers, memory));
+}
+
+const simulation_step& undo_step(time_travel_log& log, register_array& registers, memory_array& memory)
+{
+    if (log.position == 0)
+        throw std::runtime_error{ "There are no earlier steps to undo." };
+
+    const simulation_step& step = log.steps[--log.position];
+    revert_step(step, registers, memory);
+
+    return step;
+}
+
+const simulation_step& redo_step(time_travel_log& log, register_array& registers, memory_array& memory)
+{
+    if (log.position >= log.steps.size())
+        throw std::runtime_error{ "There are no later steps to redo." };
+
+    const simulation_step& step = log.steps[log.position++];
+    apply_step(step, registers, memory);
+
+    return step;
+}
+
+void seek_step(time_travel_log& log, uint64_t index, register_array& registers, memory_array& memory)
+{
+    if (index > log.steps.size())
+        throw std::runtime_error{ "Cannot seek past the last logged step." };
+
+    // undoing is cheaper than restoring a checkpoint when the target is close behind
+    if (index <= log.position && log.position - index <= index % log.checkpoint_interval)
+    {
+        while (log.position > index)
+            undo_step(log, registers, memory);
+
+        return;
+    }
+
+    if (index < log.position || index - log.position > log.checkpoint_interval)
+    {
+        const machine_checkpoint& checkpoint = log.checkpoints[index / log.checkpoint_interval];
+        registers = checkpoint.registers;
+        std::ranges::copy(checkpoint.memory, memory.begin());
+        log.position = index - index % log.checkpoint_interval;
+    }
+
+    while (log.position < index)
+        redo_step(log, registers, memory);
+}
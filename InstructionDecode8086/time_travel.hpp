@@ -0,0 +1,36 @@
+﻿#ifndef WS_TIMETRAVEL_HPP
+#define WS_TIMETRAVEL_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "simulator.hpp"
+
+struct machine_checkpoint
+{
+    register_array registers{};
+    std::vector<uint8_t> memory;
+};
+
+// every executed step, for undoing and redoing them, plus full snapshots of the machine every checkpoint_interval steps
+struct time_travel_log
+{
+    uint64_t checkpoint_interval{};
+    uint64_t position{}; // number of logged steps reflected in the current machine state
+    std::vector<simulation_step> steps;
+    std::vector<machine_checkpoint> checkpoints;
+};
+
+time_travel_log start_time_travel(uint64_t checkpoint_interval, const register_array& registers, const memory_array& memory);
+
+// logs a step that was just executed from the current position, discarding any steps that had been undone
+void record_step(time_travel_log& log, const simulation_step& step, const register_array& registers, const memory_array& memory);
+
+// both return the step that was reverted or reapplied
+const simulation_step& undo_step(time_travel_log& log, register_array& registers, memory_array& memory);
+const simulation_step& redo_step(time_travel_log& log, register_array& registers, memory_array& memory);
+
+// restores the state after the given number of logged steps from the nearest earlier checkpoint
+void seek_step(time_travel_log& log, uint64_t index, register_array& registers, memory_array& memory);
+
+#endif
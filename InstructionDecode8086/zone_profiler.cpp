@@ -0,0 +1,61 @@
+﻿#include "zone_profiler.hpp"
+
+#if SIM86_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+    // labels are shared by every thread, while the timings are per thread
+    std::array<const char*, max_profile_anchors> anchor_labels{};
+    std::atomic<uint32_t> anchor_count{ 1 };
+}
+
+uint32_t register_profile_anchor(const char* label)
+{
+    const uint32_t anchor_index = anchor_count++;
+
+    if (anchor_index >= max_profile_anchors)
+        throw std::runtime_error{ "Too many profile zones; raise max_profile_anchors." };
+
+    anchor_labels[anchor_index] = label;
+    return anchor_index;
+}
+
+zone_profile_report::zone_profile_report()
+    : start_ticks{ read_cpu_timer() }
+{
+}
+
+zone_profile_report::~zone_profile_report()
+{
+    const uint64_t total_ticks = read_cpu_timer() - start_ticks;
+    const double timer_frequency = static_cast<double>(estimate_cpu_timer_frequency());
+
+    const double total = static_cast<double>(total_ticks);
+    const double total_milliseconds = 1000.0 * total / timer_frequency;
+
+    std::cout << std::format("\nProfile zones ({:.3f} ms, {} ticks):\n", total_milliseconds, total_ticks);
+    std::cout << std::format("  {:<24} {:>12} {:>16} {:>8} {:>8}\n", "zone", "hits", "exclusive ticks", "excl", "incl");
+
+    const uint32_t used_anchors = std::min(anchor_count.load(), max_profile_anchors);
+
+    for (uint32_t i = 1; i < used_anchors; ++i)
+    {
+        const profile_anchor& anchor = zone_profiler.anchors[i];
+        if (anchor.hit_count == 0)
+            continue;
+
+        const double exclusive_percent = 100.0 * static_cast<double>(anchor.exclusive_ticks) / total;
+        const double inclusive_percent = 100.0 * static_cast<double>(anchor.inclusive_ticks) / total;
+
+        std::cout << std::format("  {:<24} {:>12} {:>16} {:>7.2f}% {:>7.2f}%\n",
+            anchor_labels[i], anchor.hit_count, anchor.exclusive_ticks, exclusive_percent, inclusive_percent);
+    }
+}
+
+#endif
@@ -0,0 +1,105 @@
+﻿#ifndef WS_ZONEPROFILER_HPP
+#define WS_ZONEPROFILER_HPP
+
+// build with SIM86_PROFILE=1 to time the zones below; otherwise the macros expand to nothing
+#ifndef SIM86_PROFILE
+#define SIM86_PROFILE 0
+#endif
+
+#if SIM86_PROFILE
+
+#include <array>
+#include <cstdint>
+
+#include "platform_metrics.hpp"
+
+inline constexpr uint32_t max_profile_anchors = 64;
+
+// totals for every time one zone was entered, where exclusive time leaves out the zones nested inside it
+struct profile_anchor
+{
+    uint64_t exclusive_ticks{};
+    uint64_t inclusive_ticks{};
+    uint64_t hit_count{};
+};
+
+// anchor 0 stands for being outside every zone
+struct zone_profiler_state
+{
+    std::array<profile_anchor, max_profile_anchors> anchors{};
+    uint32_t current_parent{};
+};
+
+// zones are timed per thread, and the report covers the thread that prints it
+inline thread_local zone_profiler_state zone_profiler;
+
+// gives each zone its own anchor the first time it is entered
+uint32_t register_profile_anchor(const char* label);
+
+struct profile_zone
+{
+    explicit profile_zone(uint32_t index)
+        : anchor_index{ index },
+          parent_index{ zone_profiler.current_parent },
+          old_inclusive_ticks{ zone_profiler.anchors[index].inclusive_ticks }
+    {
+        zone_profiler.current_parent = index;
+        start_ticks = read_cpu_timer();
+    }
+
+    ~profile_zone()
+    {
+        const uint64_t elapsed = read_cpu_timer() - start_ticks;
+        zone_profiler.current_parent = parent_index;
+
+        // the parent's exclusive time must not include this zone; unsigned wraparound evens out once the parent ends
+        zone_profiler.anchors[parent_index].exclusive_ticks -= elapsed;
+
+        // a zone nested inside itself would otherwise count the inner time twice
+        profile_anchor& anchor = zone_profiler.anchors[anchor_index];
+        anchor.exclusive_ticks += elapsed;
+        anchor.inclusive_ticks = old_inclusive_ticks + elapsed;
+        ++anchor.hit_count;
+    }
+
+    profile_zone(const profile_zone&) = delete;
+    profile_zone& operator=(const profile_zone&) = delete;
+
+    uint32_t anchor_index{};
+    uint32_t parent_index{};
+    uint64_t old_inclusive_ticks{};
+    uint64_t start_ticks{};
+};
+
+// prints every zone's share of the time since it was created when it goes out of scope
+struct zone_profile_report
+{
+    zone_profile_report();
+    ~zone_profile_report();
+
+    zone_profile_report(const zone_profile_report&) = delete;
+    zone_profile_report& operator=(const zone_profile_report&) = delete;
+
+    uint64_t start_ticks{};
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#define PROFILE_ZONE(label) \
+    static const uint32_t PROFILE_CONCAT(profile_anchor_, __LINE__) = register_profile_anchor(label); \
+    const profile_zone PROFILE_CONCAT(profile_zone_, __LINE__){ PROFILE_CONCAT(profile_anchor_, __LINE__) }
+
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+
+#define PROFILE_REPORT_AT_EXIT() const zone_profile_report profile_report_at_exit{}
+
+#else
+
+#define PROFILE_ZONE(label)
+#define PROFILE_FUNCTION()
+#define PROFILE_REPORT_AT_EXIT()
+
+#endif
+
+#endif